@@ -0,0 +1,17 @@
+# SPDX-License-Identifier: GPL-2.0
+#
+# Benchmarks, only run by the top level `make bench`.  Include it from
+# the tests Makefile after BENCH_PROGS, and before lib.mk, so that those
+# are built along with the tests.  lib.mk's all stays the default goal.
+.DEFAULT_GOAL := all
+OUTPUT ?= $(CURDIR)
+BENCH_OUTPUT ?= /dev/stdout
+TEST_GEN_FILES += $(BENCH_PROGS)
+
+.PHONY: run_bench
+run_bench: $(addprefix $(OUTPUT)/,$(BENCH_PROGS))
+	@for BENCH in $(BENCH_PROGS); do                              \
+		if ! $(OUTPUT)/$$BENCH >> $(BENCH_OUTPUT); then       \
+			exit 1;                                       \
+		fi;                                                   \
+	done
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#ifndef _KERNEL_IN_ACTION_CURRENTTIME_CURRENTTIME_H
+#define _KERNEL_IN_ACTION_CURRENTTIME_CURRENTTIME_H
+
+#include <linux/types.h>
+
+/*
+ * mmap(2) layout of the /dev/currenttimeX time page.
+ *
+ * The read only page at the offset 0 is updated by the kernel on each
+ * tick, while the device is open, with the odd seq during the update.
+ * The readers retry until they see the same even seq before and after
+ * reading the values, with the acquire load of the first seq and the
+ * read barrier before the second one, same as read_seqcount_begin()
+ * and read_seqcount_retry() in the kernel.
+ */
+struct currenttime_page {
+	__u32	seq;
+	__u32	__pad;
+	__u64	jiffies_64;
+	__u64	monotonic_ns;	/* CLOCK_MONOTONIC */
+	__u64	realtime_ns;	/* CLOCK_REALTIME */
+};
+
+/*
+ * read(2) record of the /dev/currenttimeX sampling stream.
+ *
+ * Each online CPU samples the clocks from its own hrtimer, every
+ * sample_period_ns module parameter, into the per-CPU ring.  read(2)
+ * drains the rings CPU by CPU, in the whole records only.  The seq
+ * gaps tell the samples lost on the full ring or the late timer.
+ */
+struct currenttime_sample {
+	__u64	seq;		/* per-CPU sample number */
+	__u64	expires_ns;	/* CLOCK_MONOTONIC, of the timer */
+	__u64	monotonic_ns;	/* CLOCK_MONOTONIC */
+	__u64	realtime_ns;	/* CLOCK_REALTIME */
+	__u64	jiffies_64;
+	__u32	cpu;
+	__u32	__pad;
+};
+
+#endif /* _KERNEL_IN_ACTION_CURRENTTIME_CURRENTTIME_H */
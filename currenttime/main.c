@@ -6,22 +6,39 @@
 #include <linux/err.h>
 #include <linux/device.h>
 #include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/mutex.h>
+#include <linux/timer.h>
+#include <linux/timekeeping.h>
+#include <linux/hrtimer.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/smp.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/wait.h>
+#include <linux/sched/signal.h>
+#include <linux/uaccess.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/time.h>
 #include <linux/jiffies.h>
 
 #include "../ldd/ldd.h"
+#include "currenttime.h"
 
 #define MAX_NR_CURRENTTIME	512
+#define CURRENTTIME_DEV_PREFIX	"currenttime"
+#define CURRENTTIME_RING_SIZE	4096	/* default samples per CPU */
+#define CURRENTTIME_MIN_PERIOD	10000	/* nsec */
 
-/* sysfs based currenttime device */
+/* sysfs based currenttime device, with /dev/currenttimeX time page */
 struct currenttime_device {
 	struct ldd_device		dev;
-	struct device_attribute		jiffies;
-	struct device_attribute		jiffies_64;
-	struct device_attribute		gettimeofday;
-	struct device_attribute		current_kernel_time;
+	struct cdev			cdev;
 };
 
 static ssize_t show_jiffies(struct device *dev, struct device_attribute *attr,
@@ -52,86 +69,51 @@ static ssize_t show_current_kernel_time(struct device *dev,
 	return snprintf(buf, PAGE_SIZE, "%ld.%ld\n", ts.tv_sec, ts.tv_nsec);
 }
 
+static DEVICE_ATTR(jiffies, S_IRUGO, show_jiffies, NULL);
+static DEVICE_ATTR(jiffies_64, S_IRUGO, show_jiffies_64, NULL);
+static DEVICE_ATTR(gettimeofday, S_IRUGO, show_gettimeofday, NULL);
+static DEVICE_ATTR(current_kernel_time, S_IRUGO, show_current_kernel_time, NULL);
+
+/* created along with the device */
+static struct attribute *currenttime_attrs[] = {
+	&dev_attr_jiffies.attr,
+	&dev_attr_jiffies_64.attr,
+	&dev_attr_gettimeofday.attr,
+	&dev_attr_current_kernel_time.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(currenttime);
+
 static struct currenttime_device currenttime_devices[] = {
 	{
-		.dev.name			= "currenttime0",
-		.jiffies.attr.name		= "jiffies",
-		.jiffies.attr.mode		= S_IRUGO,
-		.jiffies.show			= show_jiffies,
-		.jiffies_64.attr.name		= "jiffies_64",
-		.jiffies_64.attr.mode		= S_IRUGO,
-		.jiffies_64.show		= show_jiffies_64,
-		.gettimeofday.attr.name		= "gettimeofday",
-		.gettimeofday.attr.mode		= S_IRUGO,
-		.gettimeofday.show		= show_gettimeofday,
-		.current_kernel_time.attr.name	= "current_kernel_time",
-		.current_kernel_time.attr.mode	= S_IRUGO,
-		.current_kernel_time.show	= show_current_kernel_time,
+		.dev.name		= "currenttime0",
+		.dev.dev.groups		= currenttime_groups,
 	},
 	{ /* sentry */ },
 };
+#define NR_CURRENTTIME_DEV	(ARRAY_SIZE(currenttime_devices)-1)
 
-static int __init currenttime_init_sysfs(void)
+static int __init currenttime_init_sysfs(dev_t devt)
 {
-	struct currenttime_device *d, *delete;
-	int err;
+	struct currenttime_device *d;
 
-	for (d = currenttime_devices; d->dev.name; d++) {
-		err = register_ldd_device(&d->dev);
-		if (err)
-			return err;
+	for (d = currenttime_devices; d->dev.name; d++)
+		d->dev.dev.devt = devt + (d - currenttime_devices);
 
-		err = device_create_file(&d->dev.dev, &d->jiffies);
-		if (err) {
-			unregister_ldd_device(&d->dev);
-			goto unregister;
-		}
-		err = device_create_file(&d->dev.dev, &d->jiffies_64);
-		if (err) {
-			device_remove_file(&d->dev.dev, &d->jiffies);
-			unregister_ldd_device(&d->dev);
-			goto unregister;
-		}
-		err = device_create_file(&d->dev.dev, &d->gettimeofday);
-		if (err) {
-			device_remove_file(&d->dev.dev, &d->jiffies_64);
-			device_remove_file(&d->dev.dev, &d->jiffies);
-			unregister_ldd_device(&d->dev);
-			goto unregister;
-		}
-		err = device_create_file(&d->dev.dev, &d->current_kernel_time);
-		if (err) {
-			device_remove_file(&d->dev.dev, &d->gettimeofday);
-			device_remove_file(&d->dev.dev, &d->jiffies_64);
-			device_remove_file(&d->dev.dev, &d->jiffies);
-			unregister_ldd_device(&d->dev);
-			goto unregister;
-		}
-	}
-	return 0;
-unregister:
-	delete = d;
-	for (d = currenttime_devices; d != delete; d++)
-		unregister_ldd_device(&d->dev);
-	return err;
+	/* in bulk, without the driver */
+	return register_ldd_devices(NULL, &currenttime_devices[0].dev,
+				    NR_CURRENTTIME_DEV,
+				    sizeof(currenttime_devices[0]));
 }
 
-static void __exit currenttime_exit_sysfs(void)
+static void currenttime_exit_sysfs(void)
 {
-	struct currenttime_device *d;
-
-	for (d = currenttime_devices; d->dev.name; d++) {
-		device_remove_file(&d->dev.dev, &d->current_kernel_time);
-		device_remove_file(&d->dev.dev, &d->gettimeofday);
-		device_remove_file(&d->dev.dev, &d->jiffies_64);
-		device_remove_file(&d->dev.dev, &d->jiffies);
-		unregister_ldd_device(&d->dev);
-	}
+	unregister_ldd_devices(&currenttime_devices[0].dev, NR_CURRENTTIME_DEV,
+			       sizeof(currenttime_devices[0]));
 }
 
 static void *currenttime_procfs_ct_seq_start(struct seq_file *s, loff_t *pos)
 {
-	pr_info("%s(%lld)\n", __FUNCTION__, *pos);
 	if (*pos >= MAX_NR_CURRENTTIME)
 		return NULL;
 	seq_printf(s, "jiffies\t\tjiffies_64\t\tdo_gettimeofday()\tcurrent_kernel_time()\n");
@@ -140,7 +122,6 @@ static void *currenttime_procfs_ct_seq_start(struct seq_file *s, loff_t *pos)
 
 static void *currenttime_procfs_ct_seq_next(struct seq_file *s, void *v, loff_t *pos)
 {
-	pr_info("%s(%lld)\n", __FUNCTION__, *pos);
 	(*pos)++;
 	if (*pos >= MAX_NR_CURRENTTIME)
 		return NULL;
@@ -149,7 +130,6 @@ static void *currenttime_procfs_ct_seq_next(struct seq_file *s, void *v, loff_t
 
 static void currenttime_procfs_ct_seq_stop(struct seq_file *s, void *v)
 {
-	pr_info("%s\n", __FUNCTION__);
 	return;
 }
 
@@ -158,7 +138,6 @@ static int currenttime_procfs_ct_seq_show(struct seq_file *s, void *v)
 	struct timeval tv;
 	struct timespec ts;
 
-	pr_info("%s\n", __FUNCTION__);
 	do_gettimeofday(&tv);
 	ts = current_kernel_time();
 	seq_printf(s, "0x%08lx\t0x%016llx\t%ld.%ld\t%ld.%ld\n", jiffies, get_jiffies_64(),
@@ -176,7 +155,6 @@ const static struct seq_operations currenttime_procfs_ct_seq_ops = {
 
 static int currenttime_procfs_ct_open(struct inode *i, struct file *f)
 {
-	pr_info("%s\n", __FUNCTION__);
 	return seq_open(f, &currenttime_procfs_ct_seq_ops);
 }
 
@@ -204,8 +182,326 @@ static void currenttime_exit_procfs(void)
 	remove_proc_entry("currenttime", NULL);
 }
 
+/*
+ * time page, shared by all the /dev/currenttimeX devices and updated
+ * by the tick timer while any of those is open.  It's mapped read only,
+ * see currenttime.h for the reader side.
+ */
+static dev_t currenttime_devt;
+static struct currenttime_page *time_page;
+static struct timer_list time_page_timer;
+static DEFINE_MUTEX(time_page_lock);	/* users and the timer */
+static int time_page_users;
+
+/* the single writer, so the raw seqcount without the lock */
+static void currenttime_update_time_page(void)
+{
+	struct currenttime_page *p = time_page;
+
+	WRITE_ONCE(p->seq, p->seq+1);
+	smp_wmb();
+	p->jiffies_64 = get_jiffies_64();
+	p->monotonic_ns = ktime_get_ns();
+	p->realtime_ns = ktime_get_real_ns();
+	smp_wmb();
+	WRITE_ONCE(p->seq, p->seq+1);
+}
+
+static void currenttime_time_page_tick(struct timer_list *t)
+{
+	currenttime_update_time_page();
+	mod_timer(t, jiffies+1);
+}
+
+/*
+ * per-CPU sampling ring, with the single producer, the pinned hrtimer
+ * on the CPU, and the single consumer, read(2) with sample_lock held.
+ */
+struct currenttime_ring {
+	struct hrtimer			timer;
+	unsigned int			head;	/* moved by the timer */
+	unsigned int			tail;	/* moved by the reader */
+	u64				seq;
+	struct currenttime_sample	*samples;
+};
+
+static int ring_size = CURRENTTIME_RING_SIZE;
+module_param(ring_size, int, S_IRUGO);
+
+static struct currenttime_ring __percpu *rings;
+static DEFINE_MUTEX(sample_lock);	/* the reader and the period */
+static DECLARE_WAIT_QUEUE_HEAD(sample_wq);
+static u64 sample_period;		/* nsec, 0 when stopped */
+
+static enum hrtimer_restart currenttime_sample_tick(struct hrtimer *t)
+{
+	struct currenttime_ring *r = container_of(t, struct currenttime_ring, timer);
+	unsigned int head = r->head;
+	struct currenttime_sample *s;
+	u64 period;
+
+	/* drop the sample on the full ring, leaving the seq gap */
+	if (head - smp_load_acquire(&r->tail) < ring_size) {
+		s = &r->samples[head & (ring_size-1)];
+		s->seq = r->seq;
+		s->expires_ns = ktime_to_ns(hrtimer_get_expires(t));
+		s->monotonic_ns = ktime_get_ns();
+		s->realtime_ns = ktime_get_real_ns();
+		s->jiffies_64 = get_jiffies_64();
+		s->cpu = smp_processor_id();
+		smp_store_release(&r->head, head+1);
+	}
+	if (wq_has_sleeper(&sample_wq))
+		wake_up_interruptible(&sample_wq);
+
+	period = READ_ONCE(sample_period);
+	if (!period)
+		return HRTIMER_NORESTART;
+	/* the missed expiries count as the lost samples as well */
+	r->seq += hrtimer_forward_now(t, ns_to_ktime(period));
+	return HRTIMER_RESTART;
+}
+
+/* on each CPU, as the pinned timer is queued on the local CPU */
+static void currenttime_start_sampling(void *info)
+{
+	struct currenttime_ring *r = this_cpu_ptr(rings);
+
+	hrtimer_start(&r->timer, ns_to_ktime(sample_period),
+		      HRTIMER_MODE_REL_PINNED);
+}
+
+/* with sample_lock held */
+static void currenttime_set_period(u64 period)
+{
+	int cpu;
+
+	WRITE_ONCE(sample_period, 0);
+	for_each_possible_cpu(cpu)
+		hrtimer_cancel(&per_cpu_ptr(rings, cpu)->timer);
+	if (!period)
+		return;
+	WRITE_ONCE(sample_period, period);
+	on_each_cpu(currenttime_start_sampling, NULL, 1);
+}
+
+static int set_sample_period(const char *val, const struct kernel_param *kp)
+{
+	u64 period;
+	int err;
+
+	err = kstrtou64(val, 10, &period);
+	if (err)
+		return err;
+	if (period && period < CURRENTTIME_MIN_PERIOD)
+		return -EINVAL;
+
+	/* started by the init, when it's given on the load */
+	mutex_lock(&sample_lock);
+	if (rings) {
+		get_online_cpus();
+		currenttime_set_period(period);
+		put_online_cpus();
+	} else
+		sample_period = period;
+	mutex_unlock(&sample_lock);
+	return 0;
+}
+
+static int get_sample_period(char *buf, const struct kernel_param *kp)
+{
+	return sprintf(buf, "%llu\n", READ_ONCE(sample_period));
+}
+
+static const struct kernel_param_ops sample_period_ops = {
+	.set	= set_sample_period,
+	.get	= get_sample_period,
+};
+module_param_cb(sample_period_ns, &sample_period_ops, NULL, S_IRUGO|S_IWUSR);
+
+static int __init currenttime_init_rings(void)
+{
+	int cpu;
+
+	if (ring_size < 1)
+		ring_size = CURRENTTIME_RING_SIZE;
+	ring_size = roundup_pow_of_two(ring_size);
+
+	rings = alloc_percpu(struct currenttime_ring);
+	if (!rings)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu) {
+		struct currenttime_ring *r = per_cpu_ptr(rings, cpu);
+
+		hrtimer_init(&r->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+		r->timer.function = currenttime_sample_tick;
+		r->samples = kvmalloc_node(sizeof(*r->samples)*ring_size,
+					   GFP_KERNEL, cpu_to_node(cpu));
+		if (!r->samples)
+			goto free;
+	}
+	return 0;
+free:
+	for_each_possible_cpu(cpu)
+		kvfree(per_cpu_ptr(rings, cpu)->samples);
+	free_percpu(rings);
+	rings = NULL;
+	return -ENOMEM;
+}
+
+static void currenttime_exit_rings(void)
+{
+	int cpu;
+
+	mutex_lock(&sample_lock);
+	currenttime_set_period(0);
+	mutex_unlock(&sample_lock);
+	for_each_possible_cpu(cpu)
+		kvfree(per_cpu_ptr(rings, cpu)->samples);
+	free_percpu(rings);
+}
+
+/* copy the samples to the user, ring by ring, with sample_lock held */
+static ssize_t currenttime_drain_rings(char __user *buf, size_t nr)
+{
+	size_t done = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct currenttime_ring *r = per_cpu_ptr(rings, cpu);
+		unsigned int tail = r->tail;
+		unsigned int head = smp_load_acquire(&r->head);
+
+		while (tail != head && done < nr) {
+			/* up to the wrap around of the ring */
+			size_t off = tail & (ring_size-1);
+			size_t n = min3((size_t)(head-tail), nr-done,
+					(size_t)ring_size-off);
+
+			if (copy_to_user(buf+done*sizeof(*r->samples),
+					 &r->samples[off], n*sizeof(*r->samples)))
+				return -EFAULT;
+			tail += n;
+			done += n;
+		}
+		smp_store_release(&r->tail, tail);
+		if (done == nr)
+			break;
+	}
+	return done*sizeof(struct currenttime_sample);
+}
+
+static bool currenttime_has_samples(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct currenttime_ring *r = per_cpu_ptr(rings, cpu);
+		if (smp_load_acquire(&r->head) != READ_ONCE(r->tail))
+			return true;
+	}
+	return false;
+}
+
+static ssize_t currenttime_cdev_read(struct file *f, char __user *buf,
+				     size_t len, loff_t *pos)
+{
+	size_t nr = len/sizeof(struct currenttime_sample);
+	ssize_t ret;
+
+	/* whole records only */
+	if (!nr)
+		return -EINVAL;
+
+	for (;;) {
+		if (mutex_lock_interruptible(&sample_lock))
+			return -ERESTARTSYS;
+		ret = currenttime_drain_rings(buf, nr);
+		mutex_unlock(&sample_lock);
+		if (ret)
+			return ret;
+		if (f->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(sample_wq,
+					     currenttime_has_samples()))
+			return -ERESTARTSYS;
+	}
+}
+
+static int currenttime_cdev_open(struct inode *i, struct file *f)
+{
+	/* the first user starts the timer, with the fresh values */
+	mutex_lock(&time_page_lock);
+	if (!time_page_users++) {
+		currenttime_update_time_page();
+		mod_timer(&time_page_timer, jiffies+1);
+	}
+	mutex_unlock(&time_page_lock);
+	return 0;
+}
+
+/* called on the last fput(), which is after the last munmap() */
+static int currenttime_cdev_release(struct inode *i, struct file *f)
+{
+	mutex_lock(&time_page_lock);
+	if (!--time_page_users)
+		del_timer_sync(&time_page_timer);
+	mutex_unlock(&time_page_lock);
+	return 0;
+}
+
+static int currenttime_cdev_mmap(struct file *f, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND|VM_DONTDUMP;
+	return remap_pfn_range(vma, vma->vm_start,
+			       virt_to_phys(time_page) >> PAGE_SHIFT,
+			       PAGE_SIZE, vma->vm_page_prot);
+}
+
+static const struct file_operations currenttime_cdev_ops = {
+	.owner   = THIS_MODULE,
+	.open    = currenttime_cdev_open,
+	.release = currenttime_cdev_release,
+	.read    = currenttime_cdev_read,
+	.mmap    = currenttime_cdev_mmap,
+};
+
+static int __init currenttime_init_cdev(void)
+{
+	struct currenttime_device *d, *delete;
+	int err;
+
+	for (d = currenttime_devices; d->dev.name; d++) {
+		cdev_init(&d->cdev, &currenttime_cdev_ops);
+		d->cdev.owner = THIS_MODULE;
+		err = cdev_add(&d->cdev, d->dev.dev.devt, 1);
+		if (err)
+			goto delete;
+	}
+	return 0;
+delete:
+	delete = d;
+	for (d = currenttime_devices; d != delete; d++)
+		cdev_del(&d->cdev);
+	return err;
+}
+
+static void __exit currenttime_exit_cdev(void)
+{
+	struct currenttime_device *d;
+
+	for (d = currenttime_devices; d->dev.name; d++)
+		cdev_del(&d->cdev);
+}
+
 static int __init currenttime_init(void)
 {
+	const int nr = NR_CURRENTTIME_DEV;
 	int err;
 
 	pr_info("%s\n", __FUNCTION__);
@@ -214,12 +510,46 @@ static int __init currenttime_init(void)
 	if (err)
 		return err;
 
+	/* time page, before any device is opened */
+	err = -ENOMEM;
+	time_page = (struct currenttime_page *)get_zeroed_page(GFP_KERNEL);
+	if (!time_page)
+		goto unregister;
+	timer_setup(&time_page_timer, currenttime_time_page_tick, 0);
+
+	/* sampling rings, started when sample_period_ns is given */
+	err = currenttime_init_rings();
+	if (err)
+		goto free_page;
+	mutex_lock(&sample_lock);
+	if (sample_period)
+		currenttime_set_period(sample_period);
+	mutex_unlock(&sample_lock);
+
+	err = alloc_chrdev_region(&currenttime_devt, 0, nr,
+				  CURRENTTIME_DEV_PREFIX);
+	if (err)
+		goto exit_rings;
+
 	/* sysfs based currenttime devices */
-	err = currenttime_init_sysfs();
+	err = currenttime_init_sysfs(currenttime_devt);
 	if (err)
-		goto unregister;
+		goto unregister_chrdev;
+
+	/* for /dev/currenttimeX */
+	err = currenttime_init_cdev();
+	if (err)
+		goto exit_sysfs;
 
 	return 0;
+exit_sysfs:
+	currenttime_exit_sysfs();
+unregister_chrdev:
+	unregister_chrdev_region(currenttime_devt, nr);
+exit_rings:
+	currenttime_exit_rings();
+free_page:
+	free_page((unsigned long)time_page);
 unregister:
 	currenttime_exit_procfs();
 	return err;
@@ -228,8 +558,14 @@ module_init(currenttime_init);
 
 static void __exit currenttime_exit(void)
 {
+	const int nr = NR_CURRENTTIME_DEV;
+
 	pr_info("%s\n", __FUNCTION__);
+	currenttime_exit_cdev();
 	currenttime_exit_sysfs();
+	unregister_chrdev_region(currenttime_devt, nr);
+	currenttime_exit_rings();
+	free_page((unsigned long)time_page);
 	currenttime_exit_procfs();
 }
 module_exit(currenttime_exit);
@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../currenttime.h"
+
+#include "kselftest.h"
+
+/* seqcount reader, see currenttime.h */
+static void read_time_page(const struct currenttime_page *p,
+			   struct currenttime_page *snap)
+{
+	__u32 seq;
+
+	do {
+		while ((seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+		snap->jiffies_64 = p->jiffies_64;
+		snap->monotonic_ns = p->monotonic_ns;
+		snap->realtime_ns = p->realtime_ns;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) != seq);
+}
+
+static __u64 now_ns(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return (__u64)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int mmap_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		int		flags;
+		int		prot;
+		int		want_errno;
+	} tests[] = {
+		{
+			.name		= "/dev/currenttime0 read only mapping",
+			.dev_name	= "/dev/currenttime0",
+			.flags		= O_RDONLY,
+			.prot		= PROT_READ,
+		},
+		{
+			.name		= "/dev/currenttime0 no writable mapping",
+			.dev_name	= "/dev/currenttime0",
+			.flags		= O_RDWR,
+			.prot		= PROT_READ|PROT_WRITE,
+			.want_errno	= EPERM,
+		},
+		{ /* sentry */ },
+	};
+	long page_size = sysconf(_SC_PAGESIZE);
+	const struct test *t;
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		struct currenttime_page before, after;
+		const struct currenttime_page *p;
+		__u64 mono, real;
+		int fd;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		fd = open(t->dev_name, t->flags);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+		p = mmap(NULL, page_size, t->prot, MAP_SHARED, fd, 0);
+		if (t->want_errno) {
+			if (p != MAP_FAILED || errno != t->want_errno) {
+				printf("mmap() errno=%d, want %d\n", errno,
+				       t->want_errno);
+				goto fail_close;
+			}
+			goto pass;
+		}
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			goto fail_close;
+		}
+
+		/* within a few ticks of the system clocks */
+		read_time_page(p, &before);
+		mono = now_ns(CLOCK_MONOTONIC);
+		real = now_ns(CLOCK_REALTIME);
+		if (mono - before.monotonic_ns > 100000000 ||
+		    real - before.realtime_ns > 100000000) {
+			printf("monotonic=%llu/%llu realtime=%llu/%llu\n",
+			       before.monotonic_ns, mono,
+			       before.realtime_ns, real);
+			munmap((void *)p, page_size);
+			goto fail_close;
+		}
+
+		/* and updated by the kernel */
+		usleep(50000);
+		read_time_page(p, &after);
+		if (after.jiffies_64 <= before.jiffies_64 ||
+		    after.monotonic_ns <= before.monotonic_ns) {
+			printf("jiffies_64=%llu->%llu not updated\n",
+			       before.jiffies_64, after.jiffies_64);
+			munmap((void *)p, page_size);
+			goto fail_close;
+		}
+		munmap((void *)p, page_size);
+pass:
+		close(fd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail_close:
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	if (mmap_test(&i))
+		fail++;
+
+	puts("");
+	if (fail)
+		ksft_exit_fail();
+	else
+		ksft_exit_pass();
+}
@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../currenttime.h"
+
+#include "kselftest.h"
+
+#define SAMPLE_PERIOD_NAME	"/sys/module/currenttime/parameters/sample_period_ns"
+#define MAX_CPUS		1024
+
+static int set_sample_period(const char *period)
+{
+	int ret;
+	int fd;
+
+	fd = open(SAMPLE_PERIOD_NAME, O_WRONLY);
+	if (fd == -1)
+		return -1;
+	ret = write(fd, period, strlen(period));
+	close(fd);
+	return ret == strlen(period) ? 0 : -1;
+}
+
+/* drain the leftover, after stopping the sampling */
+static void drain(int fd)
+{
+	struct currenttime_sample buf[64];
+	int flags = fcntl(fd, F_GETFL);
+
+	fcntl(fd, F_SETFL, flags|O_NONBLOCK);
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	fcntl(fd, F_SETFL, flags);
+}
+
+static int stream_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		const char	*period;
+		int		duration;	/* msec */
+	} tests[] = {
+		{
+			.name		= "/dev/currenttime0 1ms sampling stream",
+			.dev_name	= "/dev/currenttime0",
+			.period		= "1000000",
+			.duration	= 100,
+		},
+		{
+			.name		= "/dev/currenttime0 100us sampling stream",
+			.dev_name	= "/dev/currenttime0",
+			.period		= "100000",
+			.duration	= 100,
+		},
+		{ /* sentry */ },
+	};
+	static long long last_seq[MAX_CPUS];
+	struct currenttime_sample buf[256];
+	const struct test *t;
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		long total = 0;
+		int ret;
+		int fd;
+		int j;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		fd = open(t->dev_name, O_RDONLY);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+		drain(fd);
+		memset(last_seq, 0xff, sizeof(last_seq));
+		if (set_sample_period(t->period)) {
+			perror("set_sample_period");
+			goto fail_close;
+		}
+		usleep(t->duration*1000);
+		if (set_sample_period("0")) {
+			perror("set_sample_period");
+			goto fail_close;
+		}
+
+		/* packed records, with the seq moving forward per CPU */
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+		while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+			if (ret % sizeof(buf[0])) {
+				printf("%d=read() partial record\n", ret);
+				goto fail_close;
+			}
+			for (j = 0; j < ret/sizeof(buf[0]); j++) {
+				const struct currenttime_sample *s = &buf[j];
+
+				if (s->cpu >= MAX_CPUS ||
+				    (long long)s->seq <= last_seq[s->cpu] ||
+				    s->monotonic_ns < s->expires_ns) {
+					printf("cpu=%u seq=%llu expires=%llu monotonic=%llu\n",
+					       s->cpu, s->seq, s->expires_ns,
+					       s->monotonic_ns);
+					goto fail_close;
+				}
+				last_seq[s->cpu] = s->seq;
+			}
+			total += ret/sizeof(buf[0]);
+		}
+		if (ret == -1 && errno != EAGAIN) {
+			perror("read");
+			goto fail_close;
+		}
+		if (!total) {
+			puts("no samples");
+			goto fail_close;
+		}
+
+		/* whole records only */
+		if (read(fd, buf, sizeof(buf[0])-1) != -1 || errno != EINVAL) {
+			puts("short read() not rejected");
+			goto fail_close;
+		}
+		close(fd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail_close:
+		set_sample_period("0");
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	if (stream_test(&i))
+		fail++;
+
+	puts("");
+	if (fail)
+		ksft_exit_fail();
+	else
+		ksft_exit_pass();
+}
@@ -3,19 +3,33 @@
 #ifndef _LDD_H
 #define _LDD_H
 
-/* ldd device */
+#include <linux/device.h>
+#include <linux/jump_label.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+
+/*
+ * ldd device.  The attributes go to dev.groups, so that those are
+ * created along with the device, and the device is bound to the driver
+ * directly, when set, instead of by the driver name prefix.  The driver
+ * is available through dev.driver right after the registration.
+ */
 struct ldd_device {
 	const char		*name;
+	struct ldd_driver	*driver;
 	struct device		dev;
 };
 #define to_ldd_device(_dev)	container_of(_dev, struct ldd_device, dev)
 
-/* ldd device driver */
+/*
+ * ldd device driver.  Same as the devices, the attributes go to
+ * driver.groups.
+ */
 struct ldd_driver {
 	const char		*version;
 	struct module		*module;
+	size_t			name_len;	/* of driver.name, for the match */
 	struct device_driver	driver;
-	struct driver_attribute	version_attr;
 };
 #define to_ldd_driver(_drv)	container_of(_drv, struct ldd_driver, driver)
 
@@ -25,7 +39,59 @@ static inline const char *ldd_dev_name(const struct ldd_device *dev)
 }
 int register_ldd_device(struct ldd_device *dev);
 void unregister_ldd_device(struct ldd_device *dev);
+int register_ldd_devices(struct ldd_driver *drv, struct ldd_device *dev,
+			 int nr, size_t stride);
+void unregister_ldd_devices(struct ldd_device *dev, int nr, size_t stride);
 int register_ldd_driver(struct ldd_driver *drv);
 void unregister_ldd_driver(struct ldd_driver *drv);
 
+/*
+ * ldd latency histograms, in the power of 2 nsec buckets, e.g. the
+ * bucket n counts the latency in [2^(n-1), 2^n) nsec.  Those are per
+ * device and per CPU, so that the hot path doesn't share anything, and
+ * folded on read through /sys/kernel/debug/ldd/<name>/latency.  The
+ * measurement is off by default, and is only a nop branch until it's
+ * enabled through /sys/module/ldd/parameters/latency.
+ */
+enum ldd_lat {
+	LDD_LAT_LOCK,		/* lock wait */
+	LDD_LAT_COPY,		/* copy from or to the user */
+	LDD_LAT_SLEEP,		/* sleep on the wait queue */
+	LDD_LAT_NR,
+};
+#define LDD_LAT_BUCKETS		32
+
+struct ldd_lat_hist {
+	unsigned long		count[LDD_LAT_NR][LDD_LAT_BUCKETS];
+};
+
+struct ldd_stats {
+	const char			*name;
+	struct ldd_lat_hist __percpu	*hist;
+	struct dentry			*dir;
+};
+
+DECLARE_STATIC_KEY_FALSE(ldd_stats_enabled);
+
+/* the start time, or 0 when the measurement is off */
+static inline u64 ldd_stats_start(void)
+{
+	if (static_branch_unlikely(&ldd_stats_enabled))
+		return ktime_get_ns();
+	return 0;
+}
+
+void __ldd_stats_end(struct ldd_stats *st, enum ldd_lat lat, u64 start);
+
+/* account the latency since ldd_stats_start() */
+static inline void ldd_stats_end(struct ldd_stats *st, enum ldd_lat lat,
+				 u64 start)
+{
+	if (static_branch_unlikely(&ldd_stats_enabled) && start)
+		__ldd_stats_end(st, lat, start);
+}
+
+int register_ldd_stats(struct ldd_stats *st, const char *name);
+void unregister_ldd_stats(struct ldd_stats *st);
+
 #endif /* _LDD_H */
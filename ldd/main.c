@@ -5,9 +5,58 @@
 #include <linux/kernel.h>
 #include <linux/device.h>
 #include <linux/string.h>
+#include <linux/moduleparam.h>
+#include <linux/jump_label.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/async.h>
+#include <linux/slab.h>
 
 #include "ldd.h"
 
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
+EXPORT_TRACEPOINT_SYMBOL(ldd_op);
+EXPORT_TRACEPOINT_SYMBOL(ldd_latency);
+
+/* latency measurement switch, off by default */
+DEFINE_STATIC_KEY_FALSE(ldd_stats_enabled);
+EXPORT_SYMBOL(ldd_stats_enabled);
+
+static int set_latency(const char *val, const struct kernel_param *kp)
+{
+	bool enable;
+	int err;
+
+	err = kstrtobool(val, &enable);
+	if (err)
+		return err;
+	if (enable)
+		static_branch_enable(&ldd_stats_enabled);
+	else
+		static_branch_disable(&ldd_stats_enabled);
+	return 0;
+}
+
+static int get_latency(char *buf, const struct kernel_param *kp)
+{
+	return sprintf(buf, "%c\n",
+		       static_key_enabled(&ldd_stats_enabled) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops latency_ops = {
+	.set	= set_latency,
+	.get	= get_latency,
+};
+module_param_cb(latency, &latency_ops, NULL, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(latency, "measure the latency histograms");
+
+/* /sys/kernel/debug/ldd */
+static struct dentry *ldd_debugfs;
+
 static void ldd_bus_release(struct device *d)
 {
 	pr_info("%s(%s)\n", __FUNCTION__, dev_name(d));
@@ -18,33 +67,56 @@ static struct device ldd_bus = {
 	.release = ldd_bus_release,
 };
 
+/*
+ * called for each device and driver pair, only for the devices without
+ * the driver, or on the driver registration, as the devices with the
+ * driver are bound directly by register_ldd_device().  The pointer
+ * comparison for those, and the driver name as a prefix of the devices
+ * to be managed otherwise.
+ */
 static int ldd_match(struct device *dev, struct device_driver *drv)
 {
-	pr_info("%s(device[%s], driver[%s])\n", __FUNCTION__,
-		dev_name(dev), drv->name);
-	/* use driver name as a prefix of the devices to be managed */
-	return !strncmp(dev_name(dev), drv->name, strlen(drv->name));
+	const struct ldd_device *d = to_ldd_device(dev);
+	const struct ldd_driver *ld = to_ldd_driver(drv);
+
+	if (d->driver)
+		return d->driver == ld;
+	return !strncmp(dev_name(dev), drv->name, ld->name_len);
 }
 
-static int ldd_uevent(struct device *dev, struct kobj_uevent_env *env)
+static ssize_t version_show(struct device_driver *drv, char *buf)
 {
-	pr_info("%s(%s)\n", __FUNCTION__, dev_name(dev));
-	return 0;
+	const struct ldd_driver *d = to_ldd_driver(drv);
+	return snprintf(buf, PAGE_SIZE, "%s\n", d->version);
 }
+static DRIVER_ATTR_RO(version);
+
+/* common to all the drivers, created along with the driver */
+static struct attribute *ldd_drv_attrs[] = {
+	&driver_attr_version.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(ldd_drv);
 
 static struct bus_type ldd_bus_type = {
 	.name = "ldd",
 	.match = ldd_match,
-	.uevent = ldd_uevent,
+	.drv_groups = ldd_drv_groups,
 };
 
 static void ldd_dev_release(struct device *dev)
 {
-	pr_info("%s(%s)\n", __FUNCTION__, dev_name(dev));
+	/* nothing to free, as the devices are static */
 }
 
+/*
+ * the device with the driver is bound to it directly, without walking
+ * the bus drivers for the match, so the driver should be registered
+ * first.
+ */
 int register_ldd_device(struct ldd_device *dev)
 {
+	dev->dev.driver = dev->driver ? &dev->driver->driver : NULL;
 	dev->dev.bus = &ldd_bus_type;
 	dev->dev.parent = &ldd_bus;
 	dev->dev.release = ldd_dev_release;
@@ -59,42 +131,198 @@ void unregister_ldd_device(struct ldd_device *dev)
 }
 EXPORT_SYMBOL(unregister_ldd_device);
 
-static ssize_t show_version(struct device_driver *drv, char *buf)
+#define ldd_device_at(_dev, _i, _stride) \
+	((struct ldd_device *)((char *)(_dev) + (_i)*(_stride)))
+
+/* devices registered by each async batch */
+#define LDD_BATCH_SIZE	64
+
+struct ldd_batch {
+	struct ldd_device	*dev;	/* the first one in the batch */
+	int			nr;
+	size_t			stride;
+	int			done;	/* registered ones */
+	int			err;
+};
+
+static ASYNC_DOMAIN_EXCLUSIVE(ldd_async_domain);
+
+static void register_ldd_batch(void *data, async_cookie_t cookie)
 {
-	const struct ldd_driver *d = to_ldd_driver(drv);
-	sprintf(buf, "%s\n", d->version);
-	return strlen(buf);
+	struct ldd_batch *b = data;
+
+	for (b->done = 0; b->done < b->nr; b->done++) {
+		b->err = register_ldd_device(ldd_device_at(b->dev, b->done,
+							   b->stride));
+		if (b->err)
+			break;
+	}
 }
 
-int register_ldd_driver(struct ldd_driver *drv)
+/*
+ * register nr devices in bulk, bound to drv directly unless it's NULL.
+ * Those are embedded in the driver's own descriptor array, every stride
+ * bytes from dev, and registered in parallel by the LDD_BATCH_SIZE
+ * batches.  All the registered ones are unregistered on failure.
+ */
+int register_ldd_devices(struct ldd_driver *drv, struct ldd_device *dev,
+			 int nr, size_t stride)
 {
-	int err;
+	struct ldd_batch one, *batches = NULL, *b;
+	int nr_batches = DIV_ROUND_UP(nr, LDD_BATCH_SIZE);
+	int size = LDD_BATCH_SIZE;
+	int err = 0;
+	int i;
 
-	drv->driver.bus = &ldd_bus_type;
-	err = driver_register(&drv->driver);
-	if (err)
-		return err;
-	drv->version_attr.attr.name = "version";
-	drv->version_attr.attr.mode = S_IRUGO;
-	drv->version_attr.show = show_version;
-	drv->version_attr.store = NULL;
-	err = driver_create_file(&drv->driver, &drv->version_attr);
+	if (nr <= 0)
+		return 0;
+	for (i = 0; i < nr; i++)
+		ldd_device_at(dev, i, stride)->driver = drv;
+
+	if (nr_batches > 1)
+		batches = kcalloc(nr_batches, sizeof(*batches), GFP_KERNEL);
+	if (!batches) {
+		/* in line, for a batch or less, or without memory */
+		batches = &one;
+		nr_batches = 1;
+		size = nr;
+	}
+	for (i = 0, b = batches; i < nr_batches; i++, b++) {
+		b->dev = ldd_device_at(dev, i*size, stride);
+		b->nr = min(nr - i*size, size);
+		b->stride = stride;
+	}
+
+	if (batches == &one) {
+		register_ldd_batch(&one, 0);
+	} else {
+		for (i = 0; i < nr_batches; i++)
+			async_schedule_domain(register_ldd_batch, &batches[i],
+					      &ldd_async_domain);
+		async_synchronize_full_domain(&ldd_async_domain);
+	}
+
+	for (i = 0, b = batches; i < nr_batches; i++, b++)
+		if (b->err && !err)
+			err = b->err;
 	if (err)
-		goto unregister;
-	return 0;
-unregister:
-	driver_unregister(&drv->driver);
+		for (i = 0, b = batches; i < nr_batches; i++, b++)
+			unregister_ldd_devices(b->dev, b->done, stride);
+	if (batches != &one)
+		kfree(batches);
 	return err;
 }
+EXPORT_SYMBOL(register_ldd_devices);
+
+void unregister_ldd_devices(struct ldd_device *dev, int nr, size_t stride)
+{
+	while (nr--)
+		unregister_ldd_device(ldd_device_at(dev, nr, stride));
+}
+EXPORT_SYMBOL(unregister_ldd_devices);
+
+int register_ldd_driver(struct ldd_driver *drv)
+{
+	drv->driver.bus = &ldd_bus_type;
+	drv->name_len = strlen(drv->driver.name);
+	return driver_register(&drv->driver);
+}
 EXPORT_SYMBOL(register_ldd_driver);
 
 void unregister_ldd_driver(struct ldd_driver *drv)
 {
-	driver_remove_file(&drv->driver, &drv->version_attr);
 	driver_unregister(&drv->driver);
 }
 EXPORT_SYMBOL(unregister_ldd_driver);
 
+void __ldd_stats_end(struct ldd_stats *st, enum ldd_lat lat, u64 start)
+{
+	u64 nsec = ktime_get_ns() - start;
+	int bucket = min(fls64(nsec), LDD_LAT_BUCKETS-1);
+
+	/* preempt safe, and no lock with the per-CPU histogram */
+	this_cpu_inc(st->hist->count[lat][bucket]);
+	trace_ldd_latency(st->name, lat, nsec);
+}
+EXPORT_SYMBOL(__ldd_stats_end);
+
+/* fold the per-CPU histograms, bucket by bucket */
+static int latency_show(struct seq_file *m, void *v)
+{
+	const struct ldd_stats *st = m->private;
+	unsigned long sum[LDD_LAT_NR];
+	int i, lat, cpu;
+
+	seq_printf(m, "%12s %12s %12s %12s\n", "nsec", "lock", "copy", "sleep");
+	for (i = 0; i < LDD_LAT_BUCKETS; i++) {
+		memset(sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu)
+			for (lat = 0; lat < LDD_LAT_NR; lat++)
+				sum[lat] += per_cpu_ptr(st->hist, cpu)->count[lat][i];
+		seq_printf(m, "%12llu %12lu %12lu %12lu\n",
+			   i ? 1ULL << (i-1) : 0ULL, sum[LDD_LAT_LOCK],
+			   sum[LDD_LAT_COPY], sum[LDD_LAT_SLEEP]);
+	}
+	return 0;
+}
+
+static int latency_open(struct inode *i, struct file *f)
+{
+	return single_open(f, latency_show, i->i_private);
+}
+
+/* any write resets the histograms */
+static ssize_t latency_write(struct file *f, const char __user *buf,
+			     size_t n, loff_t *pos)
+{
+	struct ldd_stats *st = file_inode(f)->i_private;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(st->hist, cpu), 0,
+		       sizeof(struct ldd_lat_hist));
+	return n;
+}
+
+static const struct file_operations latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= latency_open,
+	.read		= seq_read,
+	.write		= latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int register_ldd_stats(struct ldd_stats *st, const char *name)
+{
+	st->name = name;
+	st->hist = alloc_percpu(struct ldd_lat_hist);
+	if (!st->hist)
+		return -ENOMEM;
+
+	/* debugfs is optional */
+	if (!ldd_debugfs)
+		return 0;
+	st->dir = debugfs_create_dir(name, ldd_debugfs);
+	if (IS_ERR_OR_NULL(st->dir)) {
+		st->dir = NULL;
+		return 0;
+	}
+	debugfs_create_file("latency", S_IRUGO|S_IWUSR, st->dir, st,
+			    &latency_fops);
+	return 0;
+}
+EXPORT_SYMBOL(register_ldd_stats);
+
+void unregister_ldd_stats(struct ldd_stats *st)
+{
+	debugfs_remove_recursive(st->dir);
+	st->dir = NULL;
+	free_percpu(st->hist);
+	st->hist = NULL;
+}
+EXPORT_SYMBOL(unregister_ldd_stats);
+
 static int __init ldd_init(void)
 {
 	int err;
@@ -109,6 +337,9 @@ static int __init ldd_init(void)
 	if (err)
 		goto unregister;
 
+	ldd_debugfs = debugfs_create_dir("ldd", NULL);
+	if (IS_ERR(ldd_debugfs))
+		ldd_debugfs = NULL;
 	return 0;
 unregister:
 	bus_unregister(&ldd_bus_type);
@@ -119,6 +350,7 @@ module_init(ldd_init);
 static void __exit ldd_exit(void)
 {
 	pr_info("%s\n", __FUNCTION__);
+	debugfs_remove_recursive(ldd_debugfs);
 	device_unregister(&ldd_bus);
 	bus_unregister(&ldd_bus_type);
 }
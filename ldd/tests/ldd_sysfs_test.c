@@ -25,6 +25,11 @@ static int sysfs_test(int *i)
 			.sysfs_name =	"/sys/devices/ldd0/uevent",
 			.flags =	O_RDONLY,
 		},
+		{
+			.name =		"/sys/module/ldd/parameters/latency module parameter",
+			.sysfs_name =	"/sys/module/ldd/parameters/latency",
+			.flags =	O_RDWR,
+		},
 		{ /* sentry */ },
 	};
 	const struct test *t;
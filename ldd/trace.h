@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ldd
+
+#if !defined(_KERNEL_IN_ACTION_LDD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _KERNEL_IN_ACTION_LDD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * file operation, shared by the scull* and sleepy devices, e.g.
+ * /sys/kernel/debug/tracing/events/ldd/ldd_op, instead of the
+ * printk on each call.
+ */
+TRACE_EVENT(ldd_op,
+	TP_PROTO(const char *name, const char *op, size_t len, long ret),
+	TP_ARGS(name, op, len, ret),
+	TP_STRUCT__entry(
+		__string(	name,	name	)
+		__string(	op,	op	)
+		__field(	size_t,	len	)
+		__field(	long,	ret	)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__assign_str(op, op);
+		__entry->len = len;
+		__entry->ret = ret;
+	),
+	TP_printk("dev=%s op=%s len=%zu ret=%ld",
+		  __get_str(name), __get_str(op), __entry->len, __entry->ret)
+);
+
+/* each sample of the latency histograms, see ldd.h */
+TRACE_EVENT(ldd_latency,
+	TP_PROTO(const char *name, int lat, u64 nsec),
+	TP_ARGS(name, lat, nsec),
+	TP_STRUCT__entry(
+		__string(	name,	name	)
+		__field(	int,	lat	)
+		__field(	u64,	nsec	)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->lat = lat;
+		__entry->nsec = nsec;
+	),
+	TP_printk("dev=%s lat=%s nsec=%llu", __get_str(name),
+		  __print_symbolic(__entry->lat,
+				   { 0, "lock" }, { 1, "copy" }, { 2, "sleep" }),
+		  __entry->nsec)
+);
+
+#endif /* _KERNEL_IN_ACTION_LDD_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
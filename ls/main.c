@@ -4,16 +4,229 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/string.h>
 #include <linux/sched.h>
 #include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/sched/mm.h>
+#include <linux/mm.h>
+#include <linux/pid.h>
+#include <linux/pid_namespace.h>
+#include <linux/rcupdate.h>
+#include <linux/fs.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
 
-static int __init ls_init(void)
+#define LS_PROCFS_NAME		"ls"
+#define LS_FILTER_LEN		128
+
+/*
+ * per open filter, written to the file as the space separated
+ * key=value pairs, e.g. "threads=1 state=RD comm=kworker min_rss=256".
+ * Each write replaces the previous filter, and the empty one matches
+ * all the thread group leaders.
+ */
+struct ls_filter {
+	bool		threads;	/* all the threads, not only the leaders */
+	char		states[16];	/* task state letters, e.g. "RD" */
+	char		comm[TASK_COMM_LEN];	/* comm prefix */
+	unsigned long	min_rss;	/* in pages */
+};
+
+/* seq_file iterator, with the pid number as the cursor */
+struct ls_iter {
+	struct pid_namespace	*ns;
+	struct ls_filter	filter;
+};
+
+static unsigned long ls_task_rss(struct task_struct *t)
+{
+	unsigned long rss = 0;
+
+	/* t->mm is only stable under task_lock() */
+	task_lock(t);
+	if (t->mm)
+		rss = get_mm_rss(t->mm);
+	task_unlock(t);
+	return rss;
+}
+
+static bool ls_match(const struct ls_filter *f, struct task_struct *t)
+{
+	if (!f->threads && !thread_group_leader(t))
+		return false;
+	if (f->states[0] &&
+	    !strchr(f->states, task_index_to_char(task_state_index(t))))
+		return false;
+	if (f->comm[0] && strncmp(t->comm, f->comm, strlen(f->comm)))
+		return false;
+	if (f->min_rss && ls_task_rss(t) < f->min_rss)
+		return false;
+	return true;
+}
+
+/*
+ * find the next matching task from the pid number *pos, under
+ * rcu_read_lock().  The cursor is the pid number, not the task, so
+ * that each read(2) takes the RCU read lock only for its own chunk,
+ * and resumes from where the previous one stopped.
+ */
+static struct task_struct *ls_next_task(struct ls_iter *it, loff_t *pos)
 {
 	struct task_struct *t;
+	struct pid *pid;
+
+	for (;; (*pos)++) {
+		pid = find_ge_pid(*pos, it->ns);
+		if (!pid)
+			return NULL;
+		*pos = pid_nr_ns(pid, it->ns);
+		t = pid_task(pid, PIDTYPE_PID);
+		if (t && ls_match(&it->filter, t))
+			return t;
+	}
+}
+
+static void *ls_seq_start(struct seq_file *m, loff_t *pos)
+{
+	rcu_read_lock();
+	return ls_next_task(m->private, pos);
+}
+
+static void *ls_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	(*pos)++;
+	return ls_next_task(m->private, pos);
+}
+
+static void ls_seq_stop(struct seq_file *m, void *v)
+{
+	rcu_read_unlock();
+}
+
+/* pid, tgid, comm, state, CPU and RSS in pages, tab separated */
+static int ls_seq_show(struct seq_file *m, void *v)
+{
+	struct ls_iter *it = m->private;
+	struct task_struct *t = v;
+	char comm[TASK_COMM_LEN];
+
+	__get_task_comm(comm, sizeof(comm), t);
+	seq_put_decimal_ull(m, "", task_pid_nr_ns(t, it->ns));
+	seq_put_decimal_ull(m, "\t", task_tgid_nr_ns(t, it->ns));
+	seq_putc(m, '\t');
+	seq_escape(m, comm, "\t\n\\");
+	seq_putc(m, '\t');
+	seq_putc(m, task_index_to_char(task_state_index(t)));
+	seq_put_decimal_ull(m, "\t", task_cpu(t));
+	seq_put_decimal_ull(m, "\t", ls_task_rss(t));
+	seq_putc(m, '\n');
+	return 0;
+}
+
+static const struct seq_operations ls_seq_ops = {
+	.start	= ls_seq_start,
+	.next	= ls_seq_next,
+	.stop	= ls_seq_stop,
+	.show	= ls_seq_show,
+};
+
+static int ls_parse_filter(char *buf, struct ls_filter *f)
+{
+	char *tok;
+	int err;
+
+	memset(f, 0, sizeof(*f));
+	while ((tok = strsep(&buf, " \t\n"))) {
+		if (!*tok)
+			continue;
+		if (!strncmp(tok, "threads=", 8)) {
+			err = kstrtobool(tok+8, &f->threads);
+			if (err)
+				return err;
+		} else if (!strncmp(tok, "state=", 6)) {
+			if (strscpy(f->states, tok+6, sizeof(f->states)) < 0)
+				return -EINVAL;
+		} else if (!strncmp(tok, "comm=", 5)) {
+			if (strscpy(f->comm, tok+5, sizeof(f->comm)) < 0)
+				return -EINVAL;
+		} else if (!strncmp(tok, "min_rss=", 8)) {
+			err = kstrtoul(tok+8, 10, &f->min_rss);
+			if (err)
+				return err;
+		} else
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static ssize_t ls_procfs_write(struct file *f, const char __user *buf,
+			       size_t len, loff_t *pos)
+{
+	struct seq_file *m = f->private_data;
+	struct ls_iter *it = m->private;
+	struct ls_filter filter;
+	char kbuf[LS_FILTER_LEN];
+	int err;
+
+	if (len >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, len))
+		return -EFAULT;
+	kbuf[len] = '\0';
+	err = ls_parse_filter(kbuf, &filter);
+	if (err)
+		return err;
+
+	/* for the next read(2), after lseek(2) to the start */
+	mutex_lock(&m->lock);
+	it->filter = filter;
+	mutex_unlock(&m->lock);
+	return len;
+}
+
+static int ls_procfs_open(struct inode *i, struct file *f)
+{
+	struct ls_iter *it;
+
+	it = __seq_open_private(f, &ls_seq_ops, sizeof(*it));
+	if (!it)
+		return -ENOMEM;
+	it->ns = get_pid_ns(task_active_pid_ns(current));
+	return 0;
+}
+
+static int ls_procfs_release(struct inode *i, struct file *f)
+{
+	struct seq_file *m = f->private_data;
+	struct ls_iter *it = m->private;
+
+	put_pid_ns(it->ns);
+	return seq_release_private(i, f);
+}
+
+static const struct file_operations ls_procfs_ops = {
+	.owner		= THIS_MODULE,
+	.open		= ls_procfs_open,
+	.read		= seq_read,
+	.write		= ls_procfs_write,
+	.llseek		= seq_lseek,
+	.release	= ls_procfs_release,
+};
+
+static int __init ls_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	pr_info("%s()\n", __FUNCTION__);
 
-	/* print all the processes */
-	for_each_process(t)
-		printk("%s[%d]\n", t->comm, t->pid);
+	/* the process snapshot, on each read of /proc/ls */
+	entry = proc_create(LS_PROCFS_NAME, S_IRUGO|S_IWUSR, NULL,
+			    &ls_procfs_ops);
+	if (!entry)
+		return -ENOMEM;
 
 	return 0;
 }
@@ -22,6 +235,7 @@ module_init(ls_init);
 static void __exit ls_exit(void)
 {
 	pr_info("%s()\n", __FUNCTION__);
+	remove_proc_entry(LS_PROCFS_NAME, NULL);
 }
 module_exit(ls_exit);
 
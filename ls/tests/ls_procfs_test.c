@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kselftest.h"
+
+#define LS_PROCFS_NAME	"/proc/ls"
+#define LS_BUF_SIZE	(1 << 20)
+
+/* read all the records, in the small chunks to resume the cursor */
+static ssize_t read_all(int fd, char *buf, size_t len)
+{
+	size_t total = 0;
+	ssize_t ret;
+
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		return -1;
+	while (total < len-1) {
+		ret = read(fd, buf+total, len-total-1 < 512 ? len-total-1 : 512);
+		if (ret == -1)
+			return -1;
+		if (!ret)
+			break;
+		total += ret;
+	}
+	buf[total] = '\0';
+	return total;
+}
+
+static int test_procfs(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*filter;
+		int		want_self;
+		const char	*want_comm;	/* comm prefix of all the records */
+		char		want_state;	/* state of all the records */
+	} tests[] = {
+		{
+			.name		= "all the processes",
+			.filter		= "",
+			.want_self	= 1,
+		},
+		{
+			.name		= "comm prefix filter",
+			.filter		= "comm=ls_procfs",
+			.want_self	= 1,
+			.want_comm	= "ls_procfs",
+		},
+		{
+			.name		= "running state filter",
+			.filter		= "state=R",
+			.want_self	= 1,
+			.want_state	= 'R',
+		},
+		{
+			.name		= "threads with the comm filter",
+			.filter		= "threads=1 comm=ls_procfs",
+			.want_self	= 1,
+			.want_comm	= "ls_procfs",
+		},
+		{
+			.name		= "no zombie with our comm",
+			.filter		= "state=Z comm=ls_procfs",
+			.want_self	= 0,
+		},
+		{ /* sentinel */ },
+	};
+	const struct test *t;
+	char *buf;
+	int fail = 0;
+
+	buf = malloc(LS_BUF_SIZE);
+	for (t = tests; t->name; t++) {
+		int found = 0;
+		char *line;
+		int fd;
+
+		printf("%3d) %-12s: %-55s", ++(*i), __FUNCTION__, t->name);
+
+		fd = open(LS_PROCFS_NAME, O_RDWR);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", LS_PROCFS_NAME,
+			       strerror(errno));
+			goto fail;
+		}
+		if (write(fd, t->filter, strlen(t->filter)) != strlen(t->filter)) {
+			printf("FAIL: write(%s): %s\n", t->filter,
+			       strerror(errno));
+			goto fail_close;
+		}
+		if (read_all(fd, buf, LS_BUF_SIZE) == -1) {
+			printf("FAIL: read(%s): %s\n", LS_PROCFS_NAME,
+			       strerror(errno));
+			goto fail_close;
+		}
+
+		/* pid, tgid, comm, state, cpu and rss */
+		for (line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+			char comm[32], state;
+			unsigned long rss;
+			int pid, tgid, cpu;
+
+			if (sscanf(line, "%d\t%d\t%31[^\t]\t%c\t%d\t%lu",
+				   &pid, &tgid, comm, &state, &cpu, &rss) != 6) {
+				printf("FAIL: '%s'\n", line);
+				goto fail_close;
+			}
+			if (t->want_comm &&
+			    strncmp(comm, t->want_comm, strlen(t->want_comm))) {
+				printf("FAIL: comm='%s'\n", comm);
+				goto fail_close;
+			}
+			if (t->want_state && state != t->want_state) {
+				printf("FAIL: state='%c'\n", state);
+				goto fail_close;
+			}
+			if (pid == getpid())
+				found = 1;
+		}
+		if (found != t->want_self) {
+			printf("FAIL: self found=%d\n", found);
+			goto fail_close;
+		}
+		close(fd);
+		puts("PASS");
+		ksft_inc_pass_cnt();
+		continue;
+fail_close:
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		fail++;
+	}
+	free(buf);
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 0;
+
+	if (test_procfs(&i))
+		fail++;
+
+	if (fail)
+		ksft_exit_fail();
+	ksft_exit_pass();
+}
@@ -9,21 +9,48 @@
 #include <linux/err.h>
 #include <linux/string.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/radix-tree.h>
+#include <linux/percpu.h>
+#include <linux/page_ref.h>
+#include <linux/uio.h>
 #include <linux/uaccess.h>
 
 #include "../ldd/ldd.h"
+#include "../ldd/trace.h"
+#include "../scull/scull.h"
 
-#define SCULLCM_DRIVER_VERSION			"1.3.4"
+#define SCULLCM_DRIVER_VERSION			"1.14.0"
 #define SCULLCM_DRIVER_NAME			"scullcm"
 #define SCULLCM_DEVICE_PREFIX			SCULLCM_DRIVER_NAME
 #define SCULLCM_DEFAULT_QUANTUM_VECTOR_NR	8
 #define SCULLCM_DEFAULT_QUANTUM_SIZE		PAGE_SIZE
+#define SCULLCM_DEFAULT_MAGAZINE_SIZE		64
+#define SCULLCM_MAX_MAGAZINE_BYTES		(256*PAGE_SIZE)	/* per CPU */
+#define SCULLCM_MAX_QUANTUM_VECTOR_NR		(SCULLCM_MAX_QUANTUM_SIZE/sizeof(void *))
+#define SCULLCM_MAX_QUANTUM_SIZE		(PAGE_SIZE << (MAX_ORDER-1))
+
+/* per-CPU reserve of the recycled quanta */
+struct magazine {
+	int		nr;
+	int		high;	/* high watermark */
+	unsigned long	hits;
+	unsigned long	misses;
+	void		*quanta[];
+};
 
 /* scullcm driver */
 static struct scullcm_driver {
 	dev_t			devt_base;
 	int			qvec_nr;
 	size_t			qsize;
+	int			qorder;	/* high order quanta, if not zero */
+	int			mag_size;
+	struct magazine __percpu *mags;
 	struct kmem_cache	*qsetc;
 	struct kmem_cache	*qvecc;
 	struct kmem_cache	*quantumc;
@@ -35,9 +62,15 @@ static struct scullcm_driver {
 
 /* scullcm devices */
 static struct scullcm_device {
-	struct mutex		lock;
+	struct rw_semaphore	sem;	/* read for I/O, write for trim */
+	struct mutex		qlock;	/* qset index, quantum slots and size */
 	size_t			size;
-	struct qset		*qhead;
+	int			qvec_nr;	/* geometry, retuned by ioctl */
+	size_t			qsize;
+	struct kmem_cache	*qvecc;		/* driver's, unless retuned */
+	struct kmem_cache	*quantumc;
+	struct radix_tree_root	qsets;	/* qsets indexed by the qset number */
+	struct ldd_stats	stats;
 	struct cdev		cdev;
 	struct ldd_device	ldd;
 } devices[] = {
@@ -47,33 +80,178 @@ static struct scullcm_device {
 	{ .ldd.name = SCULLCM_DEVICE_PREFIX "3" },
 	{ /* sentinel */ },
 };
+#define NR_SCULLCM_DEV		(ARRAY_SIZE(devices)-1)
 #define to_scullcm_device(_d)	container_of(to_ldd_device(_d), struct scullcm_device, ldd)
 
 /* quantum set */
 struct qset {
-	struct qset	*next;
-	void		**data;
+	struct rw_semaphore	sem;	/* serializes writers of the quanta */
+	void			**data;
 };
 
 static const char *driver_version = SCULLCM_DRIVER_VERSION;
 static const char *driver_name = SCULLCM_DRIVER_NAME;
 static int quantum_vector_number = SCULLCM_DEFAULT_QUANTUM_VECTOR_NR;
 static int quantum_size = SCULLCM_DEFAULT_QUANTUM_SIZE;
+static int quantum_order = 0;
+static int magazine_size = SCULLCM_DEFAULT_MAGAZINE_SIZE;
 module_param(quantum_vector_number, int, S_IRUGO);
 module_param(quantum_size, int, S_IRUGO);
+module_param(quantum_order, int, S_IRUGO);
+module_param(magazine_size, int, S_IRUGO);
+
+/*
+ * Page aligned quanta come straight from the page allocator, so that
+ * those can be mapped to the user space.  The slab pages can't be.
+ */
+static inline int is_page_quantum(size_t qsize)
+{
+	return PAGE_ALIGNED(qsize);
+}
+
+/*
+ * The high order compound quanta, opted in by the quantum_order
+ * parameter, keep the large sequential workloads on the few TLB
+ * entries with the tiny qset vectors.  Those fall back to vmalloc(),
+ * when the memory is too fragmented for the high order allocation.
+ */
+static inline int is_huge_quantum(size_t qsize)
+{
+	return scullcm.qorder && qsize > PAGE_SIZE && is_power_of_2(qsize);
+}
+
+static inline struct page *quantum_page(void *q, size_t off)
+{
+	if (is_vmalloc_addr(q))
+		return vmalloc_to_page(q+off);
+	return virt_to_page(q+off);
+}
+
+static void *__alloc_quantum(struct kmem_cache *c, size_t qsize)
+{
+	struct page *page;
+
+	if (is_huge_quantum(qsize)) {
+		page = alloc_pages(GFP_KERNEL|__GFP_COMP|__GFP_ZERO|
+				   __GFP_NORETRY|__GFP_NOWARN,
+				   get_order(qsize));
+		if (page)
+			return page_address(page);
+		return vzalloc(qsize);
+	}
+	if (is_page_quantum(qsize))
+		return alloc_pages_exact(qsize, GFP_KERNEL|__GFP_ZERO);
+	return kmem_cache_zalloc(c, GFP_KERNEL);
+}
+
+static void __free_quantum(struct kmem_cache *c, size_t qsize, void *q)
+{
+	/* the pages are freed on the last unmap, if mapped */
+	if (is_vmalloc_addr(q))
+		vfree(q);
+	else if (is_huge_quantum(qsize))
+		__free_pages(virt_to_page(q), get_order(qsize));
+	else if (is_page_quantum(qsize))
+		free_pages_exact(q, qsize);
+	else
+		kmem_cache_free(c, q);
+}
+
+/* the quantum pages still referenced by the user mappings */
+static int is_mapped_quantum(size_t qsize, void *q)
+{
+	size_t off;
+
+	if (!is_page_quantum(qsize))
+		return 0;
+
+	/* the compound tail pages count on the head page */
+	if (is_huge_quantum(qsize) && !is_vmalloc_addr(q))
+		return page_count(virt_to_page(q)) != 1;
+
+	for (off = 0; off < qsize; off += PAGE_SIZE)
+		if (page_count(quantum_page(q, off)) != 1)
+			return 1;
+	return 0;
+}
+
+/*
+ * take the quantum from the local magazine first.  The magazines only
+ * hold the driver default sized quanta, so the retuned devices go
+ * straight to their own cache.
+ */
+static void *alloc_quantum(struct scullcm_device *d)
+{
+	struct scullcm_driver *drv = to_scullcm_driver(d->ldd.dev.driver);
+	struct magazine *m;
+	void *q = NULL;
+
+	if (d->qsize != drv->qsize)
+		return __alloc_quantum(d->quantumc, d->qsize);
+
+	m = get_cpu_ptr(drv->mags);
+	if (m->nr) {
+		q = m->quanta[--m->nr];
+		m->hits++;
+	} else
+		m->misses++;
+	put_cpu_ptr(drv->mags);
+
+	if (!q)
+		return __alloc_quantum(drv->quantumc, drv->qsize);
+	memset(q, 0, drv->qsize);
+	return q;
+}
+
+/* return the quantum to the local magazine, unless it's full */
+static void free_quantum(struct scullcm_device *d, void *q)
+{
+	struct scullcm_driver *drv = to_scullcm_driver(d->ldd.dev.driver);
+	struct magazine *m;
+
+	/* never recycle the pages visible to the user */
+	if (d->qsize != drv->qsize || is_mapped_quantum(d->qsize, q)) {
+		__free_quantum(d->quantumc, d->qsize, q);
+		return;
+	}
+	m = get_cpu_ptr(drv->mags);
+	if (m->nr < drv->mag_size) {
+		m->quanta[m->nr++] = q;
+		if (m->nr > m->high)
+			m->high = m->nr;
+		q = NULL;
+	}
+	put_cpu_ptr(drv->mags);
+
+	if (q)
+		__free_quantum(drv->quantumc, drv->qsize, q);
+}
 
-static struct qset *alloc_qset(struct scullcm_driver *drv)
+static void drain_magazines(struct scullcm_driver *drv)
 {
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct magazine *m = per_cpu_ptr(drv->mags, cpu);
+		while (m->nr)
+			__free_quantum(drv->quantumc, drv->qsize,
+				       m->quanta[--m->nr]);
+	}
+}
+
+static struct qset *alloc_qset(struct scullcm_device *d)
+{
+	struct scullcm_driver *drv = to_scullcm_driver(d->ldd.dev.driver);
 	struct qset *s;
 
 	s = kmem_cache_alloc(drv->qsetc, GFP_KERNEL);
 	if (!s)
 		goto err;
-	s->data = kmem_cache_alloc(drv->qvecc, GFP_KERNEL);
+	s->data = kmem_cache_alloc(d->qvecc, GFP_KERNEL);
 	if (!s->data)
 		goto err;
-	memset(s->data, 0, sizeof(void *)*drv->qvec_nr);
-	s->next = NULL;
+	memset(s->data, 0, sizeof(void *)*d->qvec_nr);
+	init_rwsem(&s->sem);
 	return s;
 err:
 	if (s)
@@ -81,175 +259,536 @@ err:
 	return ERR_PTR(-ENOMEM);
 }
 
-static void free_qset(struct scullcm_driver *drv, struct qset *s)
+static void free_qset(struct scullcm_device *d, struct qset *s)
 {
+	struct scullcm_driver *drv = to_scullcm_driver(d->ldd.dev.driver);
+
 	if (s->data) {
 		int i;
-		for (i = 0; i < drv->qvec_nr; i++)
+		for (i = 0; i < d->qvec_nr; i++)
 			if (s->data[i])
-				kmem_cache_free(drv->quantumc, s->data[i]);
-		kmem_cache_free(drv->qvecc, s->data);
+				free_quantum(d, s->data[i]);
+		kmem_cache_free(d->qvecc, s->data);
 	}
 	kmem_cache_free(drv->qsetc, s);
 }
 
-static void trim_qset(struct scullcm_device *d)
+/* trim the qsets, after zapping the user mappings, with d->qlock held */
+static void __trim_qset(struct scullcm_device *d, struct address_space *mapping)
 {
-	struct scullcm_driver *drv = to_scullcm_driver(d->ldd.dev.driver);
-	struct qset *s;
-
-	while ((s = d->qhead)) {
-		d->qhead = s->next;
-		free_qset(drv, s);
+	struct radix_tree_iter iter;
+	void **slot;
+
+	if (mapping)
+		unmap_mapping_range(mapping, 0, 0, 1);
+	radix_tree_for_each_slot(slot, &d->qsets, &iter, 0) {
+		struct qset *s = radix_tree_deref_slot(slot);
+		radix_tree_iter_delete(&d->qsets, &iter, slot);
+		free_qset(d, s);
 	}
 	d->size = 0;
 }
 
-static void *get_quantum(struct scullcm_driver *drv, struct qset *s, int s_pos)
+static void trim_qset(struct scullcm_device *d, struct address_space *mapping)
 {
-	if (!s->data[s_pos])
-		s->data[s_pos] = kmem_cache_alloc(drv->quantumc, GFP_KERNEL);
-	return s->data[s_pos];
+	mutex_lock(&d->qlock);
+	__trim_qset(d, mapping);
+	mutex_unlock(&d->qlock);
 }
 
-static ssize_t read(struct file *f, char __user *buf, size_t n, loff_t *pos)
+/*
+ * switch the device geometry, with d->qlock held and the qsets empty.
+ * The driver caches are shared by the devices with the default
+ * geometry, and the private ones are created for the others, after
+ * destroying the old ones of the same name.  The device is left with
+ * the driver geometry on failure.
+ */
+static int set_device_geometry(struct scullcm_device *d, size_t qsize,
+			       int qvec_nr)
 {
-	struct scullcm_device *d = f->private_data;
 	struct scullcm_driver *drv = to_scullcm_driver(d->ldd.dev.driver);
-	int s_pos, q_pos;
-	void *q;
-	int ret;
-
-	pr_info("%s(%s)\n", __FUNCTION__, ldd_dev_name(&d->ldd));
+	struct kmem_cache *qvecc = drv->qvecc;
+	struct kmem_cache *quantumc = drv->quantumc;
+	char name[32];
+
+	/* the old private caches, which are empty now */
+	if (d->qvecc && d->qvecc != drv->qvecc)
+		kmem_cache_destroy(d->qvecc);
+	if (d->quantumc && d->quantumc != drv->quantumc)
+		kmem_cache_destroy(d->quantumc);
+	d->qvecc = drv->qvecc;
+	d->quantumc = drv->quantumc;
+	WRITE_ONCE(d->qvec_nr, drv->qvec_nr);
+	WRITE_ONCE(d->qsize, drv->qsize);
+
+	if (qvec_nr != drv->qvec_nr) {
+		snprintf(name, sizeof(name), "%s_quantum_vector",
+			 ldd_dev_name(&d->ldd));
+		qvecc = kmem_cache_create(name, sizeof(void *)*qvec_nr,
+					  0, SLAB_HWCACHE_ALIGN, NULL);
+		if (!qvecc)
+			return -ENOMEM;
+	}
+	if (qsize != drv->qsize && is_page_quantum(qsize))
+		quantumc = NULL;
+	else if (qsize != drv->qsize) {
+		snprintf(name, sizeof(name), "%s_quantum",
+			 ldd_dev_name(&d->ldd));
+		quantumc = kmem_cache_create(name, max(qsize, sizeof(void *)),
+					     0, SLAB_HWCACHE_ALIGN, NULL);
+		if (!quantumc) {
+			if (qvecc != drv->qvecc)
+				kmem_cache_destroy(qvecc);
+			return -ENOMEM;
+		}
+	}
+	d->qvecc = qvecc;
+	d->quantumc = quantumc;
+	WRITE_ONCE(d->qvec_nr, qvec_nr);
+	WRITE_ONCE(d->qsize, qsize);
+	return 0;
+}
 
-	/* no more data to read */
-	if (*pos >= d->size)
-		return 0;
+/*
+ * trim and switch the geometry under a single d->qlock hold, so that
+ * the fault handler, which only takes d->qlock, never allocates from
+ * the old caches in between.
+ */
+static int reset_device(struct scullcm_device *d, struct address_space *mapping,
+			size_t qsize, int qvec_nr)
+{
+	int err;
 
-	/* find the quantum */
-	s_pos = *pos/drv->qsize;
-	q_pos = *pos%drv->qsize;
+	mutex_lock(&d->qlock);
+	__trim_qset(d, mapping);
+	err = set_device_geometry(d, qsize, qvec_nr);
+	mutex_unlock(&d->qlock);
+	return err;
+}
 
-	/* only single quantum read */
-	if (q_pos+n > drv->qsize)
-		n = drv->qsize-q_pos;
+/*
+ * trim and retune the device, where the negative value keeps the
+ * current one.  The old geometry is returned on success, and the
+ * device falls back to the driver geometry on failure.
+ */
+static int retune_device(struct scullcm_device *d, struct address_space *mapping,
+			 int *qsize, int *qvec_nr)
+{
+	int old_qsize, old_qvec_nr;
+	int err = 0;
 
-	if (mutex_lock_interruptible(&d->lock))
+	if (down_write_killable(&d->sem))
 		return -ERESTARTSYS;
+	old_qsize = d->qsize;
+	old_qvec_nr = d->qvec_nr;
+	if (*qsize < 0)
+		*qsize = old_qsize;
+	if (*qvec_nr < 0)
+		*qvec_nr = old_qvec_nr;
+	if (!*qsize || *qsize > SCULLCM_MAX_QUANTUM_SIZE ||
+	    !*qvec_nr || *qvec_nr > SCULLCM_MAX_QUANTUM_VECTOR_NR)
+		err = -EINVAL;
+	else if (*qsize != old_qsize || *qvec_nr != old_qvec_nr)
+		err = reset_device(d, mapping, *qsize, *qvec_nr);
+	up_write(&d->sem);
+	if (err)
+		return err;
 
-	/* no more data */
-	if (*pos == d->size) {
-		ret = 0;
-		goto out;
+	*qsize = old_qsize;
+	*qvec_nr = old_qvec_nr;
+	return 0;
+}
+
+/* find the qset, with d->qlock held.  Only written qsets are allocated. */
+static struct qset *find_qset(struct scullcm_device *d, unsigned long s_idx,
+			      int alloc)
+{
+	struct qset *s;
+	int err;
+
+	s = radix_tree_lookup(&d->qsets, s_idx);
+	if (s || !alloc)
+		return s;
+
+	s = alloc_qset(d);
+	if (IS_ERR(s))
+		return s;
+	err = radix_tree_insert(&d->qsets, s_idx, s);
+	if (err) {
+		free_qset(d, s);
+		return ERR_PTR(err);
 	}
-	/* only read the remaining data */
-	if (*pos + n >= d->size)
-		n = d->size-*pos;
+	return s;
+}
 
-	/* find the quantum */
-	ret = -EINVAL;
-	q = d->qhead->data[s_pos];
-	if (!q)
-		goto out;
+/* find the quantum, or allocate it when alloc is set, with d->qlock held */
+static void *__find_quantum(struct scullcm_device *d, unsigned long s_idx,
+			    int s_pos, int alloc, struct qset **sp)
+{
+	struct qset *s;
+	void *q;
 
-	/* copy to the user */
-	ret = -EINVAL;
-	if (copy_to_user(buf, q+q_pos, n))
-		goto out;
-	*pos += n;
-	ret = n;
-out:
-	mutex_unlock(&d->lock);
-	return ret;
+	s = find_qset(d, s_idx, alloc);
+	if (IS_ERR_OR_NULL(s))
+		return s;
+	*sp = s;
+	q = s->data[s_pos];
+	if (!q && alloc) {
+		q = alloc_quantum(d);
+		if (!q)
+			return ERR_PTR(-ENOMEM);
+		s->data[s_pos] = q;
+	}
+	return q;
 }
 
-static ssize_t write(struct file *f, const char __user *buf, size_t n, loff_t *pos)
+/*
+ * find the quantum, or allocate it when alloc is set.
+ *
+ * It returns NULL for the hole in case of !alloc.  d->qlock is only
+ * held for the lookup, not for the copy, so that the page fault on
+ * the user buffer won't dead lock with our own fault handler.  The
+ * qset is stored in sp, for the caller to lock the quantum with.
+ */
+static void *find_quantum(struct scullcm_device *d, unsigned long s_idx,
+			  int s_pos, int alloc, struct qset **sp)
 {
-	struct scullcm_device *d = f->private_data;
-	struct scullcm_driver *drv = to_scullcm_driver(d->ldd.dev.driver);
-	int s_pos, q_pos;
 	void *q;
-	int ret;
 
-	pr_info("%s(%s)\n", __FUNCTION__, ldd_dev_name(&d->ldd));
+	mutex_lock(&d->qlock);
+	q = __find_quantum(d, s_idx, s_pos, alloc, sp);
+	mutex_unlock(&d->qlock);
+	return q;
+}
 
-	/* find the quantum position */
-	s_pos = *pos/drv->qsize;
-	q_pos = *pos%drv->qsize;
+/* qset number, quantum index in the qset and the offset in the quantum */
+static void find_pos(const struct scullcm_device *d, loff_t pos,
+		     unsigned long *s_idx, int *s_pos, int *q_pos)
+{
+	unsigned long qnr = pos/d->qsize;
 
-	/* no multi qsets support */
-	if (s_pos >= drv->qvec_nr)
-		return -EINVAL;
+	*q_pos = pos%d->qsize;
+	*s_idx = qnr/d->qvec_nr;
+	*s_pos = qnr%d->qvec_nr;
+}
 
-	/* no multi quantum write */
-	if (q_pos+n > drv->qsize)
-		n = drv->qsize-q_pos;
+static ssize_t read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct scullcm_device *d = iocb->ki_filp->private_data;
+	size_t n = iov_iter_count(to);
+	size_t done, len, copied;
+	unsigned long s_idx;
+	int s_pos, q_pos;
+	struct qset *s;
+	size_t size;
+	ssize_t ret;
+	u64 start;
+	void *q;
 
-	if (mutex_lock_interruptible(&d->lock))
-		return -ERESTARTSYS;
+	/* readers run in parallel, only excluded by trim */
+	start = ldd_stats_start();
+	down_read(&d->sem);
+	ldd_stats_end(&d->stats, LDD_LAT_LOCK, start);
 
-	ret = -ENOMEM;
-	q = get_quantum(drv, d->qhead, s_pos);
-	if (!q)
+	/* no more data to read */
+	ret = 0;
+	size = READ_ONCE(d->size);
+	if (iocb->ki_pos >= size)
 		goto out;
 
-	ret = -EINVAL;
-	if (copy_from_user(q+q_pos, buf, n))
-		goto out;
-	*pos += n;
-	ret = n;
-	if (*pos > d->size)
-		d->size = *pos;
+	/* only read the remaining data */
+	if (n > size-iocb->ki_pos)
+		n = size-iocb->ki_pos;
+
+	/* find the first quantum */
+	find_pos(d, iocb->ki_pos, &s_idx, &s_pos, &q_pos);
+
+	/* copy to the iovecs, quantum by quantum, in a single pass */
+	for (done = 0; done < n; done += copied) {
+		len = min(n-done, d->qsize-q_pos);
+		q = find_quantum(d, s_idx, s_pos, 0, &s);
+		if (q) {
+			/* only wait for the writers of this qset */
+			start = ldd_stats_start();
+			down_read(&s->sem);
+			ldd_stats_end(&d->stats, LDD_LAT_LOCK, start);
+			start = ldd_stats_start();
+			copied = copy_to_iter(q+q_pos, len, to);
+			ldd_stats_end(&d->stats, LDD_LAT_COPY, start);
+			up_read(&s->sem);
+		} else
+			copied = iov_iter_zero(len, to); /* hole */
+		if (copied != len) {
+			done += copied;
+			ret = -EFAULT;
+			break;
+		}
+		q_pos = 0;
+		if (++s_pos == d->qvec_nr) {
+			s_pos = 0;
+			s_idx++;
+		}
+	}
+	/* partial read on fault */
+	if (done) {
+		iocb->ki_pos += done;
+		ret = done;
+	}
 out:
-	mutex_unlock(&d->lock);
+	up_read(&d->sem);
+	trace_ldd_op(ldd_dev_name(&d->ldd), "read", n, ret);
 	return ret;
 }
 
+static ssize_t write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct scullcm_device *d = iocb->ki_filp->private_data;
+	size_t n = iov_iter_count(from);
+	size_t done, len, copied;
+	unsigned long s_idx;
+	int s_pos, q_pos;
+	struct qset *s;
+	ssize_t ret;
+	u64 start;
+	void *q;
+
+	/* writers exclude each other per qset, see below */
+	start = ldd_stats_start();
+	down_read(&d->sem);
+	ldd_stats_end(&d->stats, LDD_LAT_LOCK, start);
+
+	/* find the first quantum position, stable until the retune */
+	find_pos(d, iocb->ki_pos, &s_idx, &s_pos, &q_pos);
+
+	/* copy from the iovecs, quantum by quantum, in a single pass */
+	ret = 0;
+	for (done = 0; done < n; done += copied) {
+		len = min(n-done, d->qsize-q_pos);
+
+		/* allocate the quantum, if needed */
+		q = find_quantum(d, s_idx, s_pos, 1, &s);
+		if (IS_ERR(q)) {
+			ret = PTR_ERR(q);
+			break;
+		}
+		/* only the readers of this qset wait for us */
+		start = ldd_stats_start();
+		down_write(&s->sem);
+		ldd_stats_end(&d->stats, LDD_LAT_LOCK, start);
+		start = ldd_stats_start();
+		copied = copy_from_iter(q+q_pos, len, from);
+		ldd_stats_end(&d->stats, LDD_LAT_COPY, start);
+		up_write(&s->sem);
+		if (copied != len) {
+			done += copied;
+			ret = -EFAULT;
+			break;
+		}
+		q_pos = 0;
+		if (++s_pos == d->qvec_nr) {
+			s_pos = 0;
+			s_idx++;
+		}
+	}
+	/* partial write on error */
+	if (done) {
+		iocb->ki_pos += done;
+		ret = done;
+		mutex_lock(&d->qlock);
+		if (iocb->ki_pos > d->size)
+			WRITE_ONCE(d->size, iocb->ki_pos);
+		mutex_unlock(&d->qlock);
+	}
+	up_read(&d->sem);
+	trace_ldd_op(ldd_dev_name(&d->ldd), "write", n, ret);
+	return ret;
+}
+
+static loff_t llseek(struct file *f, loff_t off, int whence)
+{
+	struct scullcm_device *d = f->private_data;
+
+	/* random access is cheap with the qset index */
+	return generic_file_llseek_size(f, off, whence, MAX_LFS_FILESIZE,
+					READ_ONCE(d->size));
+}
+
 static int open(struct inode *i, struct file *f)
 {
 	struct scullcm_device *d = container_of(i->i_cdev, struct scullcm_device, cdev);
-	struct scullcm_driver *drv = to_scullcm_driver(d->ldd.dev.driver);
-	struct qset *q;
-	int err = 0;
 
-	pr_info("%s(%s)\n", __FUNCTION__, ldd_dev_name(&d->ldd));
+	trace_ldd_op(ldd_dev_name(&d->ldd), "open", 0, 0);
+
+	/* trim the qset when it opened write only with trunk option */
+	if ((f->f_flags&O_ACCMODE) == O_WRONLY && f->f_flags&O_TRUNC) {
+		if (down_write_killable(&d->sem))
+			return -ERESTARTSYS;
+		trim_qset(d, f->f_mapping);
+		up_write(&d->sem);
+	}
 
+	/* qsets are allocated on the first write */
 	f->private_data = d;
-	if (mutex_lock_interruptible(&d->lock))
-		return -ERESTARTSYS;
+	return 0;
+}
 
-	/* trim the qset when it opened write only with trunk option */
-	if ((f->f_flags&O_ACCMODE) == O_WRONLY && f->f_flags&O_TRUNC)
-		trim_qset(d);
-	else if (d->qhead)
+static int release(struct inode *i, struct file *f)
+{
+	struct scullcm_device *d = f->private_data;
+
+	trace_ldd_op(ldd_dev_name(&d->ldd), "release", 0, 0);
+	f->private_data = NULL;
+
+	return 0;
+}
+
+static vm_fault_t fault(struct vm_fault *vmf)
+{
+	struct scullcm_device *d = vmf->vma->vm_file->private_data;
+	loff_t off = (loff_t)vmf->pgoff << PAGE_SHIFT;
+	unsigned long s_idx;
+	int s_pos, q_pos;
+	vm_fault_t ret;
+	struct qset *s;
+	void *q;
+
+	/* d->qlock keeps the geometry stable against the retune */
+	mutex_lock(&d->qlock);
+
+	/* retuned to the slab based quanta after mmap() */
+	ret = VM_FAULT_SIGBUS;
+	if (!is_page_quantum(d->qsize))
 		goto out;
 
-	/* start with one quantum set */
-	q = alloc_qset(drv);
-	if (IS_ERR(q)) {
-		err = PTR_ERR(q);
+	/*
+	 * no read beyond the end, same as the regular file.  The write
+	 * through the mapping extends the device to the end of the page,
+	 * and the holes within the size are filled, as the shared
+	 * mapping needs the real page behind it.
+	 */
+	ret = VM_FAULT_SIGBUS;
+	if (!(vmf->flags & FAULT_FLAG_WRITE) && off >= d->size)
 		goto out;
-	}
-	d->qhead = q;
+	find_pos(d, off, &s_idx, &s_pos, &q_pos);
+	q = __find_quantum(d, s_idx, s_pos, 1, &s);
+	ret = VM_FAULT_OOM;
+	if (IS_ERR(q))
+		goto out;
+	if (vmf->flags & FAULT_FLAG_WRITE && off + PAGE_SIZE > d->size)
+		WRITE_ONCE(d->size, off + PAGE_SIZE);
+
+	/* the reference will be dropped on unmap */
+	vmf->page = quantum_page(q, q_pos);
+	get_page(vmf->page);
+	ret = 0;
 out:
-	mutex_unlock(&d->lock);
-	return err;
+	mutex_unlock(&d->qlock);
+	return ret;
 }
 
-static int release(struct inode *i, struct file *f)
+static const struct vm_operations_struct vm_ops = {
+	.fault		= fault,
+};
+
+static int mmap(struct file *f, struct vm_area_struct *vma)
 {
 	struct scullcm_device *d = f->private_data;
 
-	pr_info("%s(%s)\n", __FUNCTION__, ldd_dev_name(&d->ldd));
-	f->private_data = NULL;
+	/* slab based quanta can't be mapped */
+	if (!is_page_quantum(READ_ONCE(d->qsize)))
+		return -ENODEV;
 
+	vma->vm_ops = &vm_ops;
+	vma->vm_flags |= VM_DONTEXPAND|VM_DONTDUMP;
 	return 0;
 }
 
+/* scull ioctl ABI, see ../scull/scull.h */
+static long ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+	struct scullcm_device *d = f->private_data;
+	struct scullcm_driver *drv = to_scullcm_driver(d->ldd.dev.driver);
+	int __user *p = (int __user *)arg;
+	int qsize = -1, qvec_nr = -1;
+	int err;
+
+	trace_ldd_op(ldd_dev_name(&d->ldd), "ioctl", 0, cmd);
+
+	if (_IOC_TYPE(cmd) != SCULL_IOC_MAGIC || _IOC_NR(cmd) > SCULL_IOC_MAXNR)
+		return -ENOTTY;
+
+	switch (cmd) {
+	case SCULL_IOCGQUANTUM:
+		return put_user((int)READ_ONCE(d->qsize), p);
+	case SCULL_IOCQQUANTUM:
+		return READ_ONCE(d->qsize);
+	case SCULL_IOCGQSET:
+		return put_user(READ_ONCE(d->qvec_nr), p);
+	case SCULL_IOCQQSET:
+		return READ_ONCE(d->qvec_nr);
+	}
+
+	/* only the admin retunes the device */
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	switch (cmd) {
+	case SCULL_IOCRESET:
+		qsize = drv->qsize;
+		qvec_nr = drv->qvec_nr;
+		return retune_device(d, f->f_mapping, &qsize, &qvec_nr);
+	case SCULL_IOCSQUANTUM:
+	case SCULL_IOCXQUANTUM:
+		if (get_user(qsize, p))
+			return -EFAULT;
+		if (qsize < 1)
+			return -EINVAL;
+		err = retune_device(d, f->f_mapping, &qsize, &qvec_nr);
+		if (err || cmd == SCULL_IOCSQUANTUM)
+			return err;
+		return put_user(qsize, p);
+	case SCULL_IOCTQUANTUM:
+	case SCULL_IOCHQUANTUM:
+		qsize = arg;
+		if (qsize < 1)
+			return -EINVAL;
+		err = retune_device(d, f->f_mapping, &qsize, &qvec_nr);
+		if (err || cmd == SCULL_IOCTQUANTUM)
+			return err;
+		return qsize;
+	case SCULL_IOCSQSET:
+	case SCULL_IOCXQSET:
+		if (get_user(qvec_nr, p))
+			return -EFAULT;
+		if (qvec_nr < 1)
+			return -EINVAL;
+		err = retune_device(d, f->f_mapping, &qsize, &qvec_nr);
+		if (err || cmd == SCULL_IOCSQSET)
+			return err;
+		return put_user(qvec_nr, p);
+	case SCULL_IOCTQSET:
+	case SCULL_IOCHQSET:
+		qvec_nr = arg;
+		if (qvec_nr < 1)
+			return -EINVAL;
+		err = retune_device(d, f->f_mapping, &qsize, &qvec_nr);
+		if (err || cmd == SCULL_IOCTQSET)
+			return err;
+		return qvec_nr;
+	default:
+		return -ENOTTY;
+	}
+}
+
 static const struct file_operations fops = {
 	.owner		= THIS_MODULE,
-	.read		= read,
-	.write		= write,
+	.llseek		= llseek,
+	.read_iter	= read_iter,
+	.write_iter	= write_iter,
+	.splice_read	= generic_file_splice_read,
+	.splice_write	= iter_file_splice_write,
+	.unlocked_ioctl	= ioctl,
+	.mmap		= mmap,
 	.open		= open,
 	.release	= release,
 };
@@ -261,51 +800,59 @@ static ssize_t show_device_size(struct device *dev,
 	return snprintf(buf, PAGE_SIZE, "%ld\n", s->size);
 }
 
-static const struct device_attribute device_size_attr = {
+static struct device_attribute device_size_attr = {
 	.attr.name	= "size",
 	.attr.mode	= S_IRUGO,
 	.show		= show_device_size,
 };
 
-static int register_device_attr(struct scullcm_device *d)
-{
-	return device_create_file(&d->ldd.dev, &device_size_attr);
-}
+/* created along with the device */
+static struct attribute *scullcm_dev_attrs[] = {
+	&device_size_attr.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(scullcm_dev);
 
-static void unregister_device_attr(struct scullcm_device *d)
+/* before the ldd device registration */
+static void init_device(struct scullcm_device *d, dev_t devt)
 {
-	device_remove_file(&d->ldd.dev, &device_size_attr);
+	/* for /dev/scullcmX file */
+	d->ldd.dev.devt = devt;
+	d->ldd.dev.groups = scullcm_dev_groups;
+
+	/* for cdev subsystem */
+	cdev_init(&d->cdev, &fops);
+	init_rwsem(&d->sem);
+	mutex_init(&d->qlock);
+	INIT_RADIX_TREE(&d->qsets, GFP_KERNEL);
 }
 
+/* after the ldd device registration, bound to scullcm directly */
 static int register_device(struct scullcm_device *d)
 {
 	int err;
 
-	err = register_ldd_device(&d->ldd);
+	err = register_ldd_stats(&d->stats, ldd_dev_name(&d->ldd));
 	if (err)
 		return err;
-
-	/* for cdev subsystem */
-	cdev_init(&d->cdev, &fops);
-	mutex_init(&d->lock);
-	err = cdev_add(&d->cdev, d->ldd.dev.devt, 1);
+	err = reset_device(d, NULL, scullcm.qsize, scullcm.qvec_nr);
 	if (err)
-		goto unregister;
-	err = register_device_attr(d);
+		goto unregister_stats;
+	err = cdev_add(&d->cdev, d->ldd.dev.devt, 1);
 	if (err)
-		goto unregister;
+		goto unregister_stats;
 	return 0;
-unregister:
-	unregister_ldd_device(&d->ldd);
+unregister_stats:
+	unregister_ldd_stats(&d->stats);
 	return err;
 }
 
 static void unregister_device(struct scullcm_device *d)
 {
-	trim_qset(d);
+	/* back to the driver caches, which destroys the private ones */
+	reset_device(d, NULL, scullcm.qsize, scullcm.qvec_nr);
 	cdev_del(&d->cdev);
-	unregister_device_attr(d);
-	unregister_ldd_device(&d->ldd);
+	unregister_ldd_stats(&d->stats);
 }
 
 static ssize_t show_driver_qvec_nr(struct device_driver *drv, char *buf)
@@ -320,37 +867,78 @@ static ssize_t show_driver_qsize(struct device_driver *drv, char *buf)
 	return snprintf(buf, PAGE_SIZE, "%ld\n", s->qsize);
 }
 
-static const struct driver_attribute driver_qvec_nr_attr = {
+static ssize_t show_driver_qorder(struct device_driver *drv, char *buf)
+{
+	struct scullcm_driver *s = to_scullcm_driver(drv);
+	return snprintf(buf, PAGE_SIZE, "%d\n", s->qorder);
+}
+
+static struct driver_attribute driver_qvec_nr_attr = {
 	.attr.name	= "quantum_vector_number",
 	.attr.mode	= S_IRUGO,
 	.show		= show_driver_qvec_nr,
 };
 
-static const struct driver_attribute driver_qsize_attr = {
+static struct driver_attribute driver_qsize_attr = {
 	.attr.name	= "quantum_size",
 	.attr.mode	= S_IRUGO,
 	.show		= show_driver_qsize,
 };
 
-static int register_driver_attr(struct scullcm_driver *drv)
+static struct driver_attribute driver_qorder_attr = {
+	.attr.name	= "quantum_order",
+	.attr.mode	= S_IRUGO,
+	.show		= show_driver_qorder,
+};
+
+static ssize_t show_driver_mag_hit_rate(struct device_driver *drv, char *buf)
 {
-	int err;
+	struct scullcm_driver *s = to_scullcm_driver(drv);
+	unsigned long hits = 0, total = 0;
+	int cpu;
 
-	err = driver_create_file(&drv->ldd.driver, &driver_qvec_nr_attr);
-	if (err)
-		return err;
-	err = driver_create_file(&drv->ldd.driver, &driver_qsize_attr);
-	if (err)
-		driver_remove_file(&drv->ldd.driver, &driver_qvec_nr_attr);
-	return err;
+	for_each_possible_cpu(cpu) {
+		const struct magazine *m = per_cpu_ptr(s->mags, cpu);
+		hits += m->hits;
+		total += m->hits + m->misses;
+	}
+	return snprintf(buf, PAGE_SIZE, "%lu\n", total ? hits*100/total : 0);
 }
 
-static void unregister_driver_attr(struct scullcm_driver *drv)
+static ssize_t show_driver_mag_high(struct device_driver *drv, char *buf)
 {
-	driver_remove_file(&drv->ldd.driver, &driver_qvec_nr_attr);
-	driver_remove_file(&drv->ldd.driver, &driver_qsize_attr);
+	struct scullcm_driver *s = to_scullcm_driver(drv);
+	int high = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		high = max(high, per_cpu_ptr(s->mags, cpu)->high);
+	return snprintf(buf, PAGE_SIZE, "%d\n", high);
 }
 
+static struct driver_attribute driver_mag_hit_rate_attr = {
+	.attr.name	= "magazine_hit_rate",
+	.attr.mode	= S_IRUGO,
+	.show		= show_driver_mag_hit_rate,
+};
+
+static struct driver_attribute driver_mag_high_attr = {
+	.attr.name	= "magazine_high_watermark",
+	.attr.mode	= S_IRUGO,
+	.show		= show_driver_mag_high,
+};
+
+/* created along with the driver */
+static struct attribute *scullcm_drv_attrs[] = {
+	&driver_qvec_nr_attr.attr,
+	&driver_qsize_attr.attr,
+	&driver_qorder_attr.attr,
+	&driver_mag_hit_rate_attr.attr,
+	&driver_mag_high_attr.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(scullcm_drv);
+
 static int register_driver(struct scullcm_driver *drv)
 {
 	int err = -ENOMEM;
@@ -369,11 +957,31 @@ static int register_driver(struct scullcm_driver *drv)
 	if (!drv->qvecc)
 		goto destroy_caches;
 
-	/* quantum cache */
+	/* quantum cache, only for the sub-page quantum */
+	err = -EINVAL;
+	if (quantum_order < 0 || quantum_order >= MAX_ORDER ||
+	    quantum_size < 1 || quantum_size > SCULLCM_MAX_QUANTUM_SIZE)
+		goto destroy_caches;
 	drv->qsize = quantum_size;
-	drv->quantumc = kmem_cache_create("scullcm_quantum", drv->qsize,
-					  0, SLAB_HWCACHE_ALIGN, NULL);
-	if (!drv->quantumc)
+	if (quantum_order) {
+		drv->qorder = quantum_order;
+		drv->qsize = PAGE_SIZE << drv->qorder;
+	}
+	err = -ENOMEM;
+	if (!is_page_quantum(drv->qsize)) {
+		drv->quantumc = kmem_cache_create("scullcm_quantum", drv->qsize,
+						  0, SLAB_HWCACHE_ALIGN, NULL);
+		if (!drv->quantumc)
+			goto destroy_caches;
+	}
+
+	/* per-CPU quantum magazines, capped by the pinned bytes */
+	drv->mag_size = clamp_t(int, magazine_size, 0,
+				SCULLCM_MAX_MAGAZINE_BYTES/drv->qsize);
+	drv->mags = __alloc_percpu(sizeof(struct magazine) +
+				   sizeof(void *)*drv->mag_size,
+				   __alignof__(struct magazine));
+	if (!drv->mags)
 		goto destroy_caches;
 
 	err = alloc_chrdev_region(&drv->devt_base, 0, ARRAY_SIZE(devices),
@@ -383,20 +991,17 @@ static int register_driver(struct scullcm_driver *drv)
 
 	drv->ldd.version = driver_version;
 	drv->ldd.driver.name = driver_name;
+	drv->ldd.driver.groups = scullcm_drv_groups;
 	err = register_ldd_driver(&drv->ldd);
 	if (err)
 		goto unregister_chrdev_region;
 
-	err = register_driver_attr(drv);
-	if (err)
-		goto unregister_driver;
-
 	return err;
-unregister_driver:
-	unregister_ldd_driver(&drv->ldd);
 unregister_chrdev_region:
 	unregister_chrdev_region(scullcm.devt_base, ARRAY_SIZE(devices));
 destroy_caches:
+	if (drv->mags)
+		free_percpu(drv->mags);
 	if (drv->quantumc)
 		kmem_cache_destroy(drv->quantumc);
 	if (drv->qvecc)
@@ -408,9 +1013,12 @@ destroy_caches:
 
 static void unregister_driver(struct scullcm_driver *drv)
 {
-	unregister_driver_attr(drv);
 	unregister_ldd_driver(&drv->ldd);
 	unregister_chrdev_region(drv->devt_base, ARRAY_SIZE(devices));
+	if (drv->mags) {
+		drain_magazines(drv);
+		free_percpu(drv->mags);
+	}
 	if (drv->quantumc)
 		kmem_cache_destroy(drv->quantumc);
 	if (drv->qvecc)
@@ -431,10 +1039,17 @@ static int __init init(void)
 	if (err)
 		return err;
 
-	for (i = 0, d = devices; d->ldd.name; i++, d++) {
-		/* for /dev/scullcmX file */
-		d->ldd.dev.devt = MKDEV(MAJOR(scullcm.devt_base),
-					MINOR(scullcm.devt_base)+i);
+	for (i = 0, d = devices; d->ldd.name; i++, d++)
+		init_device(d, MKDEV(MAJOR(scullcm.devt_base),
+				     MINOR(scullcm.devt_base)+i));
+
+	/* in bulk, bound directly, as the geometry needs the driver */
+	err = register_ldd_devices(&scullcm.ldd, &devices[0].ldd,
+				   NR_SCULLCM_DEV, sizeof(devices[0]));
+	if (err)
+		goto unregister_driver;
+
+	for (d = devices; d->ldd.name; d++) {
 		err = register_device(d);
 		if (err)
 			goto unregister;
@@ -443,6 +1058,9 @@ static int __init init(void)
 unregister:
 	for (del = devices; del != d; del++)
 		unregister_device(del);
+	unregister_ldd_devices(&devices[0].ldd, NR_SCULLCM_DEV,
+			       sizeof(devices[0]));
+unregister_driver:
 	unregister_driver(&scullcm);
 	return err;
 }
@@ -456,6 +1074,8 @@ static void __exit cleanup(void)
 
 	for (d = devices; d->ldd.name; d++)
 		unregister_device(d);
+	unregister_ldd_devices(&devices[0].ldd, NR_SCULLCM_DEV,
+			       sizeof(devices[0]));
 	unregister_driver(&scullcm);
 }
 module_exit(cleanup);
@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../../scull/scull.h"
+
+#define BENCH_NAME	"scullcm_bench"
+#define BENCH_DEV_NAME	"/dev/scullcm0"
+#define BENCH_SIZE	(16*1024*1024)
+#define BENCH_CHUNK	4096
+#define BENCH_RANDOM_OPS	16384
+
+static struct utsname uts;
+
+/* tab separated kernel release, benchmark, case, metric and value */
+static void report(const char *name, const char *metric, double value)
+{
+	printf("%s\t%s\t%s\t%s\t%.3f\n", uts.release, BENCH_NAME, name,
+	       metric, value);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* sequential write(2) or read(2) of the whole device, in chunks */
+static int sequential(int fd, int write_op, char *buf)
+{
+	size_t done;
+	int ret;
+
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		return -1;
+	for (done = 0; done < BENCH_SIZE; done += ret) {
+		if (write_op)
+			ret = write(fd, buf, BENCH_CHUNK);
+		else
+			ret = read(fd, buf, BENCH_CHUNK);
+		if (ret <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* pwrite(2) or pread(2) of the chunk aligned random offsets */
+static int random_io(int fd, int write_op, char *buf)
+{
+	off_t off;
+	int ret;
+	int j;
+
+	for (j = 0; j < BENCH_RANDOM_OPS; j++) {
+		off = (off_t)(random() % (BENCH_SIZE/BENCH_CHUNK))*BENCH_CHUNK;
+		if (write_op)
+			ret = pwrite(fd, buf, BENCH_CHUNK, off);
+		else
+			ret = pread(fd, buf, BENCH_CHUNK, off);
+		if (ret != BENCH_CHUNK)
+			return -1;
+	}
+	return 0;
+}
+
+static int quantum_sweep_bench(int *i)
+{
+	const struct test {
+		const char	*name;
+		int		qsize;
+	} tests[] = {
+		{
+			.name	= "quantum-512B",
+			.qsize	= 512,
+		},
+		{
+			.name	= "quantum-4KiB",
+			.qsize	= 4096,
+		},
+		{
+			.name	= "quantum-16KiB",
+			.qsize	= 16*1024,
+		},
+		{
+			.name	= "quantum-64KiB",
+			.qsize	= 64*1024,
+		},
+		{
+			.name	= "quantum-256KiB",
+			.qsize	= 256*1024,
+		},
+		{ /* sentry */ },
+	};
+	const struct {
+		const char	*name;
+		int		(*io)(int fd, int write_op, char *buf);
+		int		write_op;
+		size_t		bytes;
+	} ops[] = {
+		{ "seq-write",	sequential,	1, BENCH_SIZE },
+		{ "seq-read",	sequential,	0, BENCH_SIZE },
+		{ "rand-write",	random_io,	1, BENCH_RANDOM_OPS*BENCH_CHUNK },
+		{ "rand-read",	random_io,	0, BENCH_RANDOM_OPS*BENCH_CHUNK },
+	};
+	const struct test *t;
+	char buf[BENCH_CHUNK];
+	int fail = 0;
+	int fd;
+
+	memset(buf, 'q', sizeof(buf));
+	for (t = tests; t->name; t++) {
+		char name[64];
+		double start, elapsed;
+		int j;
+
+		fprintf(stderr, "%2d) %-70s", (*i)++, t->name);
+
+		/* truncate, then retune with the empty device */
+		fd = open(BENCH_DEV_NAME, O_WRONLY|O_TRUNC);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+		if (ioctl(fd, SCULL_IOCTQUANTUM, t->qsize) == -1) {
+			perror("ioctl(SCULL_IOCTQUANTUM)");
+			goto fail_close;
+		}
+		close(fd);
+
+		fd = open(BENCH_DEV_NAME, O_RDWR);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+		srandom(1); /* same offsets for all the quanta */
+		for (j = 0; j < sizeof(ops)/sizeof(ops[0]); j++) {
+			start = now();
+			if (ops[j].io(fd, ops[j].write_op, buf)) {
+				fprintf(stderr, "%s: %s\n", ops[j].name,
+					strerror(errno));
+				goto fail_close;
+			}
+			elapsed = now() - start;
+			snprintf(name, sizeof(name), "%s/%s", t->name,
+				 ops[j].name);
+			report(name, "MB/s", ops[j].bytes/elapsed/1e6);
+			report(name, "ops/s", ops[j].bytes/BENCH_CHUNK/elapsed);
+		}
+		close(fd);
+		fprintf(stderr, "DONE\n");
+		continue;
+fail_close:
+		close(fd);
+fail:
+		fprintf(stderr, "FAIL\n");
+		fail++;
+	}
+
+	/* back to the default geometry, and free the quanta */
+	fd = open(BENCH_DEV_NAME, O_WRONLY|O_TRUNC);
+	if (fd != -1) {
+		ioctl(fd, SCULL_IOCRESET);
+		close(fd);
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	uname(&uts);
+
+	if (quantum_sweep_bench(&i))
+		fail++;
+
+	return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
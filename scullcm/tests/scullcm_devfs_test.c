@@ -3,8 +3,12 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
+#include <setjmp.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -152,6 +156,62 @@ static int test_devfs(int *i)
 			.writen		= 32768,
 			.readn		= 32768,
 		},
+		{
+			.name		= "/dev/scullcm0 65536 bytes write & read",
+			.devname	= "/dev/scullcm0",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm0/size",
+			.writen		= 65536,
+			.readn		= 65536,
+		},
+		{
+			.name		= "/dev/scullcm1 65536 bytes write & read",
+			.devname	= "/dev/scullcm1",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm1/size",
+			.writen		= 65536,
+			.readn		= 65536,
+		},
+		{
+			.name		= "/dev/scullcm2 65536 bytes write & read",
+			.devname	= "/dev/scullcm2",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm2/size",
+			.writen		= 65536,
+			.readn		= 65536,
+		},
+		{
+			.name		= "/dev/scullcm3 65536 bytes write & read",
+			.devname	= "/dev/scullcm3",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm3/size",
+			.writen		= 65536,
+			.readn		= 65536,
+		},
+		{
+			.name		= "/dev/scullcm0 1048576 bytes write & read",
+			.devname	= "/dev/scullcm0",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm0/size",
+			.writen		= 1048576,
+			.readn		= 1048576,
+		},
+		{
+			.name		= "/dev/scullcm1 1048576 bytes write & read",
+			.devname	= "/dev/scullcm1",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm1/size",
+			.writen		= 1048576,
+			.readn		= 1048576,
+		},
+		{
+			.name		= "/dev/scullcm2 1048576 bytes write & read",
+			.devname	= "/dev/scullcm2",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm2/size",
+			.writen		= 1048576,
+			.readn		= 1048576,
+		},
+		{
+			.name		= "/dev/scullcm3 1048576 bytes write & read",
+			.devname	= "/dev/scullcm3",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm3/size",
+			.writen		= 1048576,
+			.readn		= 1048576,
+		},
 		{ /* sentry */ },
 	};
 	const struct test *t;
@@ -285,6 +345,436 @@ fail:
 	return fail;
 }
 
+static int test_mmap(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*devname;
+		size_t		len;
+	} tests[] = {
+		{
+			.name		= "/dev/scullcm0 4096 bytes mmap",
+			.devname	= "/dev/scullcm0",
+			.len		= 4096,
+		},
+		{
+			.name		= "/dev/scullcm1 65536 bytes mmap",
+			.devname	= "/dev/scullcm1",
+			.len		= 65536,
+		},
+		{
+			.name		= "/dev/scullcm2 1048576 bytes mmap",
+			.devname	= "/dev/scullcm2",
+			.len		= 1048576,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		char *buf = NULL, *map;
+		size_t total;
+		int ret;
+		int fd;
+		int j;
+
+		printf("%3d) %-12s: %-55s", ++(*i), __FUNCTION__, t->name);
+
+		/* fill the device with write(2) */
+		fd = open(t->devname, O_WRONLY|O_TRUNC);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		buf = malloc(t->len);
+		memset(buf, 'w', t->len);
+		for (total = 0; total < t->len; total += ret) {
+			ret = write(fd, buf+total, t->len-total);
+			if (ret <= 0) {
+				printf("FAIL: write(%ld): %s\n", t->len,
+				       strerror(errno));
+				goto fail_close;
+			}
+		}
+		close(fd);
+
+		/* check and update through the mapping */
+		fd = open(t->devname, O_RDWR);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		map = mmap(NULL, t->len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			printf("FAIL: mmap(%s): %s\n", t->devname, strerror(errno));
+			goto fail_close;
+		}
+		for (j = 0; j < t->len; j++)
+			if (map[j] != 'w') {
+				printf("FAIL: '%c'(map[%d])!='%c'\n", map[j], j, 'w');
+				munmap(map, t->len);
+				goto fail_close;
+			}
+		memset(map, 'm', t->len);
+		munmap(map, t->len);
+
+		/* read(2) should see the update */
+		memset(buf, 'r', t->len);
+		for (total = 0; total < t->len; total += ret) {
+			ret = read(fd, buf+total, t->len-total);
+			if (ret <= 0) {
+				printf("FAIL: read(%ld): %s\n", t->len,
+				       strerror(errno));
+				goto fail_close;
+			}
+		}
+		for (j = 0; j < t->len; j++)
+			if (buf[j] != 'm') {
+				printf("FAIL: '%c'(buf[%d])!='%c'\n", buf[j], j, 'm');
+				goto fail_close;
+			}
+		free(buf);
+		close(fd);
+		puts("PASS");
+		ksft_inc_pass_cnt();
+		continue;
+fail_close:
+		close(fd);
+fail:
+		if (buf)
+			free(buf);
+		ksft_inc_fail_cnt();
+		fail++;
+	}
+	return fail;
+}
+
+static sigjmp_buf sigbus_env;
+
+static void sigbus(int signo)
+{
+	siglongjmp(sigbus_env, 1);
+}
+
+static int test_mmap_size(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*devname;
+		const char	*sysfsname;
+		int		write;	/* through the mapping, or read */
+		off_t		offset;
+		int		want_sigbus;
+		const char	*want;	/* device size after the access */
+	} tests[] = {
+		{
+			.name		= "/dev/scullcm3 read beyond the size",
+			.devname	= "/dev/scullcm3",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm3/size",
+			.offset		= 0,
+			.want_sigbus	= 1,
+			.want		= "0\n",
+		},
+		{
+			.name		= "/dev/scullcm3 write extends the size",
+			.devname	= "/dev/scullcm3",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm3/size",
+			.write		= 1,
+			.offset		= 4096,
+			.want		= "8192\n",
+		},
+		{ /* sentry */ },
+	};
+	struct sigaction sa = { .sa_handler = sigbus }, old;
+	const struct test *t;
+	int fail = 0;
+
+	sigaction(SIGBUS, &sa, &old);
+	for (t = tests; t->name; t++) {
+		volatile char *map = MAP_FAILED;
+		volatile int got_sigbus = 0;
+		char buf[BUFSIZ];
+		int ret;
+		int fd;
+
+		printf("%3d) %-12s: %-55s", ++(*i), __FUNCTION__, t->name);
+
+		/* start with the empty device */
+		fd = open(t->devname, O_WRONLY|O_TRUNC);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		close(fd);
+		fd = open(t->devname, O_RDWR);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		map = mmap(NULL, t->offset+4096, PROT_READ|PROT_WRITE,
+			   MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			printf("FAIL: mmap(%s): %s\n", t->devname, strerror(errno));
+			goto fail_close;
+		}
+		if (!sigsetjmp(sigbus_env, 1)) {
+			if (t->write)
+				map[t->offset] = 'm';
+			else
+				(void)map[t->offset];
+		} else
+			got_sigbus = 1;
+		munmap((void *)map, t->offset+4096);
+		close(fd);
+		if (got_sigbus != t->want_sigbus) {
+			printf("FAIL: SIGBUS=%d\n", got_sigbus);
+			goto fail;
+		}
+
+		fd = open(t->sysfsname, O_RDONLY);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->sysfsname, strerror(errno));
+			goto fail;
+		}
+		ret = read(fd, buf, sizeof(buf)-1);
+		if (ret == -1) {
+			printf("FAIL: read(%s): %s\n", t->sysfsname, strerror(errno));
+			goto fail_close;
+		}
+		buf[ret] = '\0';
+		if (strcmp(buf, t->want)) {
+			printf("FAIL: size=%s", buf);
+			goto fail_close;
+		}
+		close(fd);
+		puts("PASS");
+		ksft_inc_pass_cnt();
+		continue;
+fail_close:
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		fail++;
+	}
+	sigaction(SIGBUS, &old, NULL);
+	return fail;
+}
+
+static int test_sparse(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*devname;
+		const char	*sysfsname;
+		off_t		offset;
+		const char	*want;
+	} tests[] = {
+		{
+			.name		= "/dev/scullcm3 write at 1MiB offset",
+			.devname	= "/dev/scullcm3",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm3/size",
+			.offset		= 1048576,
+			.want		= "1048577",
+		},
+		{
+			.name		= "/dev/scullcm3 write at 1GiB offset",
+			.devname	= "/dev/scullcm3",
+			.sysfsname	= "/sys/bus/ldd/devices/scullcm3/size",
+			.offset		= 1073741824,
+			.want		= "1073741825",
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		char buf[BUFSIZ];
+		char *nl;
+		int ret;
+		int fd;
+		int j;
+
+		printf("%3d) %-12s: %-55s", ++(*i), __FUNCTION__, t->name);
+
+		fd = open(t->devname, O_WRONLY|O_TRUNC);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		if (lseek(fd, t->offset, SEEK_SET) != t->offset) {
+			printf("FAIL: lseek(%ld): %s\n", t->offset, strerror(errno));
+			goto fail_close;
+		}
+		if (write(fd, "w", 1) != 1) {
+			printf("FAIL: write(1): %s\n", strerror(errno));
+			goto fail_close;
+		}
+		close(fd);
+
+		/* size covers the hole */
+		fd = open(t->sysfsname, O_RDONLY);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->sysfsname, strerror(errno));
+			goto fail;
+		}
+		ret = read(fd, buf, sizeof(buf)-1);
+		if (ret == -1) {
+			printf("FAIL: read(%s): %s\n", t->sysfsname, strerror(errno));
+			goto fail_close;
+		}
+		close(fd);
+		buf[ret] = '\0';
+		nl = strchr(buf, '\n');
+		if (nl)
+			*nl = '\0';
+		if (strcmp(buf, t->want)) {
+			printf("FAIL: got='%s', want='%s'\n", buf, t->want);
+			goto fail;
+		}
+
+		/* the hole reads back as zeros */
+		fd = open(t->devname, O_RDONLY);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		if (lseek(fd, t->offset-sizeof(buf), SEEK_SET) == -1) {
+			printf("FAIL: lseek(%ld): %s\n", t->offset, strerror(errno));
+			goto fail_close;
+		}
+		ret = read(fd, buf, sizeof(buf));
+		if (ret != sizeof(buf)) {
+			printf("FAIL: %d=read(%ld)\n", ret, sizeof(buf));
+			goto fail_close;
+		}
+		for (j = 0; j < sizeof(buf); j++)
+			if (buf[j]) {
+				printf("FAIL: buf[%d]=0x%02x\n", j, buf[j]);
+				goto fail_close;
+			}
+		ret = read(fd, buf, sizeof(buf));
+		if (ret != 1 || buf[0] != 'w') {
+			printf("FAIL: %d=read(%ld)\n", ret, sizeof(buf));
+			goto fail_close;
+		}
+		close(fd);
+		puts("PASS");
+		ksft_inc_pass_cnt();
+		continue;
+fail_close:
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		fail++;
+	}
+	return fail;
+}
+
+static int test_iovec(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*devname;
+		int		iovcnt;
+		size_t		iovlen;
+	} tests[] = {
+		{
+			.name		= "/dev/scullcm0 64x100 bytes writev & readv",
+			.devname	= "/dev/scullcm0",
+			.iovcnt		= 64,
+			.iovlen		= 100,
+		},
+		{
+			.name		= "/dev/scullcm1 16x4096 bytes writev & readv",
+			.devname	= "/dev/scullcm1",
+			.iovcnt		= 16,
+			.iovlen		= 4096,
+		},
+		{
+			.name		= "/dev/scullcm2 8x65536 bytes writev & readv",
+			.devname	= "/dev/scullcm2",
+			.iovcnt		= 8,
+			.iovlen		= 65536,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		size_t total = t->iovcnt*t->iovlen;
+		struct iovec *iov;
+		char *wbuf, *rbuf;
+		int ret;
+		int fd;
+		int j;
+
+		printf("%3d) %-12s: %-55s", ++(*i), __FUNCTION__, t->name);
+
+		iov = calloc(t->iovcnt, sizeof(struct iovec));
+		wbuf = malloc(total);
+		rbuf = malloc(total);
+		for (j = 0; j < total; j++)
+			wbuf[j] = 'a' + (j/t->iovlen)%26;
+		memset(rbuf, 'r', total);
+
+		fd = open(t->devname, O_WRONLY|O_TRUNC);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		for (j = 0; j < t->iovcnt; j++) {
+			iov[j].iov_base = wbuf + j*t->iovlen;
+			iov[j].iov_len = t->iovlen;
+		}
+		ret = writev(fd, iov, t->iovcnt);
+		if (ret != total) {
+			printf("FAIL: %d=writev(%ld): %s\n", ret, total,
+			       strerror(errno));
+			goto fail_close;
+		}
+		close(fd);
+
+		fd = open(t->devname, O_RDONLY);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		for (j = 0; j < t->iovcnt; j++) {
+			iov[j].iov_base = rbuf + j*t->iovlen;
+			iov[j].iov_len = t->iovlen;
+		}
+		ret = readv(fd, iov, t->iovcnt);
+		if (ret != total) {
+			printf("FAIL: %d=readv(%ld): %s\n", ret, total,
+			       strerror(errno));
+			goto fail_close;
+		}
+		if (memcmp(wbuf, rbuf, total)) {
+			puts("FAIL: readv() data mismatch");
+			goto fail_close;
+		}
+		close(fd);
+		free(iov);
+		free(wbuf);
+		free(rbuf);
+		puts("PASS");
+		ksft_inc_pass_cnt();
+		continue;
+fail_close:
+		close(fd);
+fail:
+		free(iov);
+		free(wbuf);
+		free(rbuf);
+		ksft_inc_fail_cnt();
+		fail++;
+	}
+	return fail;
+}
+
 int main(void)
 {
 	int fail = 0;
@@ -292,6 +782,14 @@ int main(void)
 
 	if (test_devfs(&i))
 		fail++;
+	if (test_mmap(&i))
+		fail++;
+	if (test_mmap_size(&i))
+		fail++;
+	if (test_sparse(&i))
+		fail++;
+	if (test_iovec(&i))
+		fail++;
 
 	if (fail)
 		ksft_exit_fail();
@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../../scull/scull.h"
+
+#include "kselftest.h"
+
+static int read_driver_attr(const char *name)
+{
+	char path[BUFSIZ], buf[BUFSIZ];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "/sys/bus/ldd/drivers/scullcm/%s", name);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	ret = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+	return atoi(buf);
+}
+
+static int test_geometry(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*devname;
+		int		qsize;
+		int		qvec_nr;
+		size_t		writen;
+	} tests[] = {
+		{
+			.name		= "/dev/scullcm0 10 bytes x 10 quanta geometry",
+			.devname	= "/dev/scullcm0",
+			.qsize		= 10,
+			.qvec_nr	= 10,
+			.writen		= 4096,
+		},
+		{
+			.name		= "/dev/scullcm1 1000 bytes x 2 quanta geometry",
+			.devname	= "/dev/scullcm1",
+			.qsize		= 1000,
+			.qvec_nr	= 2,
+			.writen		= 65536,
+		},
+		{
+			.name		= "/dev/scullcm2 65536 bytes x 1 quantum geometry",
+			.devname	= "/dev/scullcm2",
+			.qsize		= 65536,
+			.qvec_nr	= 1,
+			.writen		= 1048576,
+		},
+		{
+			.name		= "/dev/scullcm3 4096 bytes x 1000 quanta geometry",
+			.devname	= "/dev/scullcm3",
+			.qsize		= 4096,
+			.qvec_nr	= 1000,
+			.writen		= 1048576,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	int qsize, qvec_nr;
+	int fail = 0;
+
+	qsize = read_driver_attr("quantum_size");
+	qvec_nr = read_driver_attr("quantum_vector_number");
+
+	for (t = tests; t->name; t++) {
+		char *wbuf, *rbuf;
+		int val, ret;
+		int fd;
+		int j;
+
+		printf("%3d) %-12s: %-55s", ++(*i), __FUNCTION__, t->name);
+
+		wbuf = malloc(t->writen);
+		rbuf = malloc(t->writen);
+		for (j = 0; j < t->writen; j++)
+			wbuf[j] = 'a' + j%26;
+		memset(rbuf, 'r', t->writen);
+
+		fd = open(t->devname, O_RDWR);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		if (ioctl(fd, SCULL_IOCRESET) == -1) {
+			printf("FAIL: ioctl(SCULL_IOCRESET): %s\n", strerror(errno));
+			goto fail_close;
+		}
+
+		/* set and tell, then get and query */
+		val = t->qsize;
+		if (ioctl(fd, SCULL_IOCSQUANTUM, &val) == -1) {
+			printf("FAIL: ioctl(SCULL_IOCSQUANTUM): %s\n", strerror(errno));
+			goto fail_close;
+		}
+		if (ioctl(fd, SCULL_IOCTQSET, t->qvec_nr) == -1) {
+			printf("FAIL: ioctl(SCULL_IOCTQSET): %s\n", strerror(errno));
+			goto fail_close;
+		}
+		ret = ioctl(fd, SCULL_IOCGQUANTUM, &val);
+		if (ret == -1 || val != t->qsize) {
+			printf("FAIL: %d=ioctl(SCULL_IOCGQUANTUM) != %d\n",
+			       val, t->qsize);
+			goto fail_close;
+		}
+		ret = ioctl(fd, SCULL_IOCQQSET);
+		if (ret != t->qvec_nr) {
+			printf("FAIL: %d=ioctl(SCULL_IOCQQSET) != %d\n",
+			       ret, t->qvec_nr);
+			goto fail_close;
+		}
+
+		/* exchange and shift return the previous value */
+		val = t->qsize*2;
+		ret = ioctl(fd, SCULL_IOCXQUANTUM, &val);
+		if (ret == -1 || val != t->qsize) {
+			printf("FAIL: %d=ioctl(SCULL_IOCXQUANTUM) != %d\n",
+			       val, t->qsize);
+			goto fail_close;
+		}
+		ret = ioctl(fd, SCULL_IOCHQUANTUM, t->qsize);
+		if (ret != t->qsize*2) {
+			printf("FAIL: %d=ioctl(SCULL_IOCHQUANTUM) != %d\n",
+			       ret, t->qsize*2);
+			goto fail_close;
+		}
+		ret = ioctl(fd, SCULL_IOCHQSET, t->qvec_nr);
+		if (ret != t->qvec_nr) {
+			printf("FAIL: %d=ioctl(SCULL_IOCHQSET) != %d\n",
+			       ret, t->qvec_nr);
+			goto fail_close;
+		}
+
+		/* invalid geometry */
+		if (ioctl(fd, SCULL_IOCTQUANTUM, 0) != -1 || errno != EINVAL) {
+			puts("FAIL: ioctl(SCULL_IOCTQUANTUM, 0) succeeded");
+			goto fail_close;
+		}
+
+		/* write and read back with the new geometry */
+		ret = write(fd, wbuf, t->writen);
+		if (ret != t->writen) {
+			printf("FAIL: %d=write(%ld): %s\n", ret, t->writen,
+			       strerror(errno));
+			goto fail_close;
+		}
+		if (lseek(fd, 0, SEEK_SET) == -1) {
+			printf("FAIL: lseek(): %s\n", strerror(errno));
+			goto fail_close;
+		}
+		ret = read(fd, rbuf, t->writen);
+		if (ret != t->writen) {
+			printf("FAIL: %d=read(%ld): %s\n", ret, t->writen,
+			       strerror(errno));
+			goto fail_close;
+		}
+		if (memcmp(wbuf, rbuf, t->writen)) {
+			puts("FAIL: read() data mismatch");
+			goto fail_close;
+		}
+
+		/* retune trims the data */
+		ret = ioctl(fd, SCULL_IOCHQUANTUM, t->qsize+1);
+		if (ret != t->qsize) {
+			printf("FAIL: %d=ioctl(SCULL_IOCHQUANTUM) != %d\n",
+			       ret, t->qsize);
+			goto fail_close;
+		}
+		if (lseek(fd, 0, SEEK_SET) == -1 || read(fd, rbuf, 1) != 0) {
+			puts("FAIL: data survived the retune");
+			goto fail_close;
+		}
+
+		/* back to the driver default */
+		if (ioctl(fd, SCULL_IOCRESET) == -1) {
+			printf("FAIL: ioctl(SCULL_IOCRESET): %s\n", strerror(errno));
+			goto fail_close;
+		}
+		if (ioctl(fd, SCULL_IOCQQUANTUM) != qsize ||
+		    ioctl(fd, SCULL_IOCQQSET) != qvec_nr) {
+			puts("FAIL: ioctl(SCULL_IOCRESET) didn't reset geometry");
+			goto fail_close;
+		}
+		close(fd);
+		free(wbuf);
+		free(rbuf);
+		puts("PASS");
+		ksft_inc_pass_cnt();
+		continue;
+fail_close:
+		close(fd);
+fail:
+		free(wbuf);
+		free(rbuf);
+		ksft_inc_fail_cnt();
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 0;
+
+	if (test_geometry(&i))
+		fail++;
+
+	if (fail)
+		ksft_exit_fail();
+	ksft_exit_pass();
+}
@@ -20,7 +20,7 @@ static int sysfs_test(int *i)
 			.name		= "/sys/bus/ldd/drivers/scullcm/version driver version",
 			.file_name	= "/sys/bus/ldd/drivers/scullcm/version",
 			.flags		= O_RDONLY,
-			.want		= "1.3.4",
+			.want		= "1.14.0",
 		},
 		{
 			.name		= "/sys/bus/ldd/drivers/scullcm/quantum_vector_number",
@@ -34,6 +34,22 @@ static int sysfs_test(int *i)
 			.flags		= O_RDONLY,
 			.want		= "4096",
 		},
+		{
+			.name		= "/sys/bus/ldd/drivers/scullcm/quantum_order",
+			.file_name	= "/sys/bus/ldd/drivers/scullcm/quantum_order",
+			.flags		= O_RDONLY,
+			.want		= "0",
+		},
+		{
+			.name		= "/sys/bus/ldd/drivers/scullcm/magazine_hit_rate",
+			.file_name	= "/sys/bus/ldd/drivers/scullcm/magazine_hit_rate",
+			.flags		= O_RDONLY,
+		},
+		{
+			.name		= "/sys/bus/ldd/drivers/scullcm/magazine_high_watermark",
+			.file_name	= "/sys/bus/ldd/drivers/scullcm/magazine_high_watermark",
+			.flags		= O_RDONLY,
+		},
 		{
 			.name		= "/sys/bus/ldd/devices/scullcm0/size read",
 			.file_name	= "/sys/bus/ldd/devices/scullcm0/size",
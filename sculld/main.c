@@ -29,7 +29,7 @@ static struct ldd_device sculld_devices[] = {
 
 static int __init sculld_init(void)
 {
-	struct ldd_device *d, *delete;
+	const int nr = ARRAY_SIZE(sculld_devices)-1;
 	int err;
 
 	pr_info("%s\n", __FUNCTION__);
@@ -44,20 +44,13 @@ static int __init sculld_init(void)
 	if (err)
 		return err;
 
-	/* register sculld devices */
-	for (d = sculld_devices; d->name; d++) {
-		err = register_ldd_device(d);
-		if (err)
-			goto unregister;
-	}
+	/* register sculld devices in bulk, bound to sculld directly */
+	err = register_ldd_devices(&sculld_driver, sculld_devices, nr,
+				   sizeof(*sculld_devices));
+	if (err)
+		goto unregister;
 	return 0;
 unregister:
-	/*
-	 * unregister devices before d, which holds the pointer to
-	 * the failed device.
-	 */
-	for (delete = sculld_devices; d && delete != d; delete++)
-		unregister_ldd_device(delete);
 	unregister_ldd_driver(&sculld_driver);
 	return err;
 }
@@ -65,13 +58,12 @@ module_init(sculld_init);
 
 static void __exit sculld_exit(void)
 {
-	struct ldd_device *d;
+	const int nr = ARRAY_SIZE(sculld_devices)-1;
 
 	pr_info("%s\n", __FUNCTION__);
 
 	unregister_ldd_driver(&sculld_driver);
-	for (d = sculld_devices; d->name; d++)
-		unregister_ldd_device(d);
+	unregister_ldd_devices(sculld_devices, nr, sizeof(*sculld_devices));
 }
 module_exit(sculld_exit);
 
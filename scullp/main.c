@@ -9,18 +9,26 @@
 #include <linux/fs.h>
 #include <linux/wait.h>
 #include <linux/mutex.h>
+#include <linux/atomic.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
 #include <linux/sched.h>
 #include <linux/sched/signal.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/vmalloc.h>
 #include <asm/page.h>
 
+#include "../ldd/ldd.h"
+#include "../ldd/trace.h"
+#include "scullp.h"
+
 #define NR_SCULLP_DEV			4
 #define SCULLP_DEFAULT_DEBUG_STATUS	1
 #define SCULLP_DEFAULT_BUFFER_SIZE	PAGE_SIZE
 #define SCULLP_DEV_PREFIX		"scullp"
-#define SCULLP_DEV_NAME_LEN		(strlen(SCULLP_DEV_PREFIX) + 2)
+#define SCULLP_DEV_NAME_LEN		(sizeof(SCULLP_DEV_PREFIX) + 1)
 
 #define scullp_debug(fmt, ...)                                         \
 	do {                                                           \
@@ -30,17 +38,34 @@
                                ##__VA_ARGS__);                         \
 	} while (0)
 
-/* scull pipe device descriptor */
+/*
+ * scull pipe device descriptor
+ *
+ * The reader only moves readp and the writer only moves writep, with
+ * the release store after the copy and the acquire load of the other
+ * end, so that the single reader and the single writer run in parallel
+ * without any lock.  The rlock and wlock only serialize the multiple
+ * readers and the multiple writers, respectively.  The positions live
+ * in the control page, which is mapped to the user space together with
+ * the buffer, see scullp.h.
+ */
 struct scullp {
-	struct mutex			lock;
+	struct mutex			rlock;
+	struct mutex			wlock;
 	wait_queue_head_t		inwq;
 	wait_queue_head_t		outwq;
+	struct scullp_ring		*ring;	/* control page */
 	char				*buffer;
 	size_t				size;
-	size_t				readp;
-	size_t				writep;
+	int				rlowat;	/* read wakeup watermark */
+	int				wlowat;	/* write wakeup watermark */
+	int				timeout; /* in msec, below watermark */
+	atomic_t			rshort;	/* readers below rlowat */
+	atomic_t			wshort;	/* writers below wlowat */
+	struct ldd_stats		stats;
 	struct device			dev;
 	struct cdev			cdev;
+	char				name[SCULLP_DEV_NAME_LEN]; /* init_name */
 } scullps[NR_SCULLP_DEV];
 
 /* module wide variable, to be controled by module parameters and sysfs */
@@ -49,16 +74,13 @@ static int buffer_size = SCULLP_DEFAULT_BUFFER_SIZE;
 module_param(debug, int, S_IRUGO|S_IWUSR);
 module_param(buffer_size, int, S_IRUGO);
 
+/*
+ * No kernel_param_lock(), which is the module wide mutex.  The int is
+ * read atomically, and the data path uses the ldd tracepoints anyway.
+ */
 static inline int is_scullp_debug(void)
 {
-	int is_debug;
-
-	/* lock is required, as explained in linux/moduleparam.h */
-	kernel_param_lock(THIS_MODULE);
-	is_debug = debug;
-	kernel_param_unlock(THIS_MODULE);
-
-	return is_debug;
+	return READ_ONCE(debug);
 }
 
 static inline int scullp_buffer_size(void)
@@ -67,15 +89,27 @@ static inline int scullp_buffer_size(void)
 	return buffer_size;
 }
 
+/* the position in the control page, which the user may scribble on */
+static inline size_t ring_pos(const struct scullp *s, u32 pos)
+{
+	return pos < s->size ? pos : 0;
+}
+
 /* how much data ready for read? */
 static inline size_t readable_size(const struct scullp *s)
 {
-	return (s->writep + s->size - s->readp) % s->size;
+	size_t writep = ring_pos(s, smp_load_acquire(&s->ring->writep));
+	size_t readp = ring_pos(s, READ_ONCE(s->ring->readp));
+
+	return (writep + s->size - readp) % s->size;
 }
 
 /* how much space available for write? */
 static inline size_t writable_size(const struct scullp *s)
 {
+	size_t readp = ring_pos(s, smp_load_acquire(&s->ring->readp));
+	size_t writep = ring_pos(s, READ_ONCE(s->ring->writep));
+
 	/*
 	 * Since the buffer is circular, we keep the write pointer
 	 * one before the read pointer in case of the full buffer
@@ -85,42 +119,104 @@ static inline size_t writable_size(const struct scullp *s)
 	 * empty: s->readp     == s->writep
 	 * full:  s->write + 1 == s->readp
 	 */
-	if (s->readp == s->writep)
+	if (readp == writep)
 		return s->size - 1;
 
-	return ((s->readp + s->size - s->writep) % s->size) - 1;
+	return ((readp + s->size - writep) % s->size) - 1;
+}
+
+/* how long to wait for the watermark, before taking what's there */
+static inline long scullp_timeout(const struct scullp *s)
+{
+	int timeout = READ_ONCE(s->timeout);
+
+	return timeout ? msecs_to_jiffies(timeout) : MAX_SCHEDULE_TIMEOUT;
 }
 
-static ssize_t scullp_read(struct file *f, char __user *buf, size_t len, loff_t *pos)
+/*
+ * wake up the waiters at the watermark, or all of them on any progress
+ * when some wait for less than that, e.g. the read(2) shorter than
+ * rlowat.  The exclusive waiter woken up below its own need goes back
+ * to sleep without passing the wakeup on, hence all of them.
+ */
+static void wake_up_waiters(wait_queue_head_t *wq, size_t size, int lowat,
+			    atomic_t *nr_short, __poll_t key)
 {
+	/* paired with the barriers on the waiters' side */
+	if (!wq_has_sleeper(wq))
+		return;
+	if (size >= lowat)
+		wake_up_interruptible_poll(wq, key);
+	else if (size && atomic_read(nr_short))
+		wake_up_interruptible_all(wq);
+}
+
+/* count the waiter below the watermark, before checking the condition */
+static bool start_short_wait(atomic_t *nr_short, size_t need, int lowat)
+{
+	if (need >= lowat)
+		return false;
+	atomic_inc(nr_short);
+	smp_mb__after_atomic();
+	return true;
+}
+
+static ssize_t scullp_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *f = iocb->ki_filp;
 	struct scullp *s = f->private_data;
+	size_t len = iov_iter_count(to);
+	long timeout = scullp_timeout(s);
+	size_t lowat = min(len, (size_t)READ_ONCE(s->rlowat));
+	const size_t count = len;
+	int expired = 0;
 	DEFINE_WAIT(w);
+	size_t readp, n;
+	bool is_short;
 	size_t size;
+	u64 start;
 	int err;
 
-	scullp_debug("reading from %s", dev_name(&s->dev));
-
-	if (mutex_lock_interruptible(&s->lock))
+	start = ldd_stats_start();
+	if (mutex_lock_interruptible(&s->rlock))
 		return -ERESTARTSYS;
+	ldd_stats_end(&s->stats, LDD_LAT_LOCK, start);
 
-	/* wait for buffer to be ready to read */
+	/* wait for the read watermark, or the timeout with some data */
+	is_short = start_short_wait(&s->rshort, lowat, READ_ONCE(s->rlowat));
 	err = 0;
-	add_wait_queue(&s->inwq, &w);
-	while ((size = readable_size(s)) <= 0) {
+	for (;;) {
+		/* queued before the check, not to miss the wakeup */
 		prepare_to_wait_exclusive(&s->inwq, &w, TASK_INTERRUPTIBLE);
+		size = readable_size(s);
+		if (size >= lowat)
+			break;
+		if (size && (expired || f->f_flags & O_NONBLOCK))
+			break;
 		err = -EAGAIN;
 		if (f->f_flags & O_NONBLOCK)
 			break;
 		err = -EINTR;
 		if (signal_pending(current))
 			break;
-		mutex_unlock(&s->lock);
-		schedule();
-		if (mutex_lock_interruptible(&s->lock))
+		/* the writer doesn't need the lock, but other readers do */
+		mutex_unlock(&s->rlock);
+		start = ldd_stats_start();
+		expired = !schedule_timeout(timeout);
+		ldd_stats_end(&s->stats, LDD_LAT_SLEEP, start);
+		start = ldd_stats_start();
+		if (mutex_lock_interruptible(&s->rlock)) {
+			finish_wait(&s->inwq, &w);
+			if (is_short)
+				atomic_dec(&s->rshort);
 			return -ERESTARTSYS;
+		}
+		ldd_stats_end(&s->stats, LDD_LAT_LOCK, start);
 		err = 0; /* reset error before next try */
 	}
 	finish_wait(&s->inwq, &w);
+	if (is_short)
+		atomic_dec(&s->rshort);
 
 	/* error happened while waiting for the buffer */
 	if (err)
@@ -128,57 +224,97 @@ static ssize_t scullp_read(struct file *f, char __user *buf, size_t len, loff_t
 
 	/* adjust the length of the buffer to read */
 	len = min(len, size);
-	if (s->readp > s->writep)
-		len = min(len, (size_t)(s->size - s->readp));
 
-	/* copy to the user buffer */
+	/*
+	 * copy to the user buffer, or to the pipe pages in case of
+	 * splice(2), in parallel with the writer.  The data may wrap
+	 * around the buffer end, which is copied in two segments, so
+	 * that the single call drains the whole buffer.
+	 */
+	readp = ring_pos(s, READ_ONCE(s->ring->readp));
+	n = min(len, (size_t)(s->size - readp));
+	start = ldd_stats_start();
+	n = copy_to_iter(s->buffer + readp, n, to);
+	if (n == s->size - readp)
+		n += copy_to_iter(s->buffer, len - n, to);
+	ldd_stats_end(&s->stats, LDD_LAT_COPY, start);
 	err = -EFAULT;
-	if (copy_to_user(buf, s->buffer + s->readp, len))
+	if (!n && len)
 		goto out;
+	len = n; /* partial read on fault */
 
-	/* adjust the read position and the return value */
-	s->readp += len;
-	if (s->readp == s->size)
-		s->readp = 0;
+	/* publish the read position, after the copy is done */
+	readp += len;
+	if (readp >= s->size)
+		readp -= s->size;
+	smp_store_release(&s->ring->readp, readp);
 	err = len;
 
-	/* finally, wake up the writer */
-	wake_up_interruptible(&s->outwq);
+	/* finally, wake up the writer, at the write watermark */
+	wake_up_waiters(&s->outwq, writable_size(s), READ_ONCE(s->wlowat),
+			&s->wshort, POLLOUT|POLLWRNORM);
 out:
-	mutex_unlock(&s->lock);
+	mutex_unlock(&s->rlock);
+	trace_ldd_op(dev_name(&s->dev), "read", count, err);
 	return err;
 }
 
-static ssize_t scullp_write(struct file *f, const char __user *buf, size_t len, loff_t *pos)
+static ssize_t scullp_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
+	struct file *f = iocb->ki_filp;
 	struct scullp *s = f->private_data;
+	size_t len = iov_iter_count(from);
+	long timeout = scullp_timeout(s);
+	size_t lowat = min(len, (size_t)READ_ONCE(s->wlowat));
+	const size_t count = len;
+	int expired = 0;
 	DEFINE_WAIT(w);
+	size_t writep, n;
+	bool is_short;
 	size_t size;
+	u64 start;
 	int err;
 
-	scullp_debug("writing on %s", dev_name(&s->dev));
-
-	if (mutex_lock_interruptible(&s->lock))
+	start = ldd_stats_start();
+	if (mutex_lock_interruptible(&s->wlock))
 		return -ERESTARTSYS;
+	ldd_stats_end(&s->stats, LDD_LAT_LOCK, start);
 
-	/* wait for the buffer to be ready for write */
+	/* wait for the write watermark, or the timeout with some space */
+	is_short = start_short_wait(&s->wshort, lowat, READ_ONCE(s->wlowat));
 	err = 0;
-	add_wait_queue(&s->outwq, &w);
-	while ((size = writable_size(s)) <= 0) {
+	for (;;) {
+		/* queued before the check, not to miss the wakeup */
 		prepare_to_wait_exclusive(&s->outwq, &w, TASK_INTERRUPTIBLE);
+		size = writable_size(s);
+		if (size >= lowat)
+			break;
+		if (size && (expired || f->f_flags & O_NONBLOCK))
+			break;
 		err = -EAGAIN;
 		if (f->f_flags & O_NONBLOCK)
 			break;
 		err = -EINTR;
 		if (signal_pending(current))
 			break;
-		mutex_unlock(&s->lock);
-		schedule();
-		if (mutex_lock_interruptible(&s->lock))
+		/* the reader doesn't need the lock, but other writers do */
+		mutex_unlock(&s->wlock);
+		start = ldd_stats_start();
+		expired = !schedule_timeout(timeout);
+		ldd_stats_end(&s->stats, LDD_LAT_SLEEP, start);
+		start = ldd_stats_start();
+		if (mutex_lock_interruptible(&s->wlock)) {
+			finish_wait(&s->outwq, &w);
+			if (is_short)
+				atomic_dec(&s->wshort);
 			return -ERESTARTSYS;
+		}
+		ldd_stats_end(&s->stats, LDD_LAT_LOCK, start);
 		err = 0; /* reset error before next try */
 	}
 	finish_wait(&s->outwq, &w);
+	if (is_short)
+		atomic_dec(&s->wshort);
 
 	/* error happened while waiting for the buffer */
 	if (err)
@@ -186,24 +322,33 @@ static ssize_t scullp_write(struct file *f, const char __user *buf, size_t len,
 
 	/* adjust the length of the buffer to write */
 	len = min(len, size);
-	if (s->writep >= s->readp)
-		len = min(len, (size_t)(s->size - s->writep));
 
-	/* copy from the user space */
+	/* copy from the user space in two segments, as in scullp_read_iter() */
+	writep = ring_pos(s, READ_ONCE(s->ring->writep));
+	n = min(len, (size_t)(s->size - writep));
+	start = ldd_stats_start();
+	n = copy_from_iter(s->buffer + writep, n, from);
+	if (n == s->size - writep)
+		n += copy_from_iter(s->buffer, len - n, from);
+	ldd_stats_end(&s->stats, LDD_LAT_COPY, start);
 	err = -EFAULT;
-	if (copy_from_user((s->buffer + s->writep), buf, len))
+	if (!n && len)
 		goto out;
+	len = n; /* partial write on fault */
 
-	/* update the write position and the return value */
-	s->writep += len;
-	if (s->writep == s->size)
-		s->writep = 0;
+	/* publish the write position, after the copy is done */
+	writep += len;
+	if (writep >= s->size)
+		writep -= s->size;
+	smp_store_release(&s->ring->writep, writep);
 	err = len;
 
-	/* finally, wake up the reader */
-	wake_up_interruptible(&s->inwq);
+	/* finally, wake up the reader, at the read watermark */
+	wake_up_waiters(&s->inwq, readable_size(s), READ_ONCE(s->rlowat),
+			&s->rshort, POLLIN|POLLRDNORM);
 out:
-	mutex_unlock(&s->lock);
+	mutex_unlock(&s->wlock);
+	trace_ldd_op(dev_name(&s->dev), "write", count, err);
 	return err;
 }
 
@@ -212,25 +357,96 @@ static __poll_t scullp_poll(struct file *f, poll_table *p)
 	struct scullp *s = f->private_data;
 	__poll_t ret = 0;
 
-	scullp_debug("polling on %s", dev_name(&s->dev));
+	trace_ldd_op(dev_name(&s->dev), "poll", 0, 0);
 
-	if (mutex_lock_interruptible(&s->lock))
-		return -ERESTARTSYS;
-	poll_wait(f, &s->inwq, p);
-	poll_wait(f, &s->outwq, p);
-	if (readable_size(s) > 0)
+	/*
+	 * No lock, as the positions are only read.  Only the queue for
+	 * the file mode is waited on, and the wakeups carry the poll key,
+	 * so that epoll only wakes up the relevant waiters.
+	 */
+	if (f->f_mode & FMODE_READ)
+		poll_wait(f, &s->inwq, p);
+	if (f->f_mode & FMODE_WRITE)
+		poll_wait(f, &s->outwq, p);
+
+	/* paired with wq_has_sleeper() on the wakeup side */
+	smp_mb();
+
+	if (f->f_mode & FMODE_READ && readable_size(s) >= READ_ONCE(s->rlowat))
 		ret |= POLLIN|POLLRDNORM;
-	if (writable_size(s) > 0)
+	if (f->f_mode & FMODE_WRITE && writable_size(s) >= READ_ONCE(s->wlowat))
 		ret |= POLLOUT|POLLWRNORM;
-	mutex_unlock(&s->lock);
 	return ret;
 }
 
+static long scullp_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+	struct scullp *s = f->private_data;
+	int __user *p = (int __user *)arg;
+	int val;
+
+	trace_ldd_op(dev_name(&s->dev), "ioctl", 0, cmd);
+
+	if (_IOC_TYPE(cmd) != SCULLP_IOC_MAGIC || _IOC_NR(cmd) > SCULLP_IOC_MAXNR)
+		return -ENOTTY;
+
+	switch (cmd) {
+	case SCULLP_IOCKICK:
+		wake_up_interruptible_poll(&s->inwq, POLLIN|POLLRDNORM);
+		wake_up_interruptible_poll(&s->outwq, POLLOUT|POLLWRNORM);
+		return 0;
+	case SCULLP_IOCGRLOWAT:
+		return put_user(READ_ONCE(s->rlowat), p);
+	case SCULLP_IOCGWLOWAT:
+		return put_user(READ_ONCE(s->wlowat), p);
+	case SCULLP_IOCGTIMEOUT:
+		return put_user(READ_ONCE(s->timeout), p);
+	}
+
+	switch (cmd) {
+	case SCULLP_IOCSRLOWAT:
+	case SCULLP_IOCSWLOWAT:
+		if (get_user(val, p))
+			return -EFAULT;
+		/* up to the full buffer, with the one slot empty */
+		if (val < 1 || val > s->size - 1)
+			return -EINVAL;
+		if (cmd == SCULLP_IOCSRLOWAT)
+			WRITE_ONCE(s->rlowat, val);
+		else
+			WRITE_ONCE(s->wlowat, val);
+		break;
+	case SCULLP_IOCSTIMEOUT:
+		if (get_user(val, p))
+			return -EFAULT;
+		if (val < 0)
+			return -EINVAL;
+		WRITE_ONCE(s->timeout, val);
+		break;
+	default:
+		return -ENOTTY;
+	}
+	/* let the waiters re-evaluate the new watermarks */
+	wake_up_interruptible_poll(&s->inwq, POLLIN|POLLRDNORM);
+	wake_up_interruptible_poll(&s->outwq, POLLOUT|POLLWRNORM);
+	return 0;
+}
+
+static int scullp_mmap(struct file *f, struct vm_area_struct *vma)
+{
+	struct scullp *s = f->private_data;
+
+	trace_ldd_op(dev_name(&s->dev), "mmap", vma->vm_end - vma->vm_start, 0);
+
+	/* the control page and the buffer, in a single vmalloc area */
+	return remap_vmalloc_range(vma, s->ring, vma->vm_pgoff);
+}
+
 static int scullp_open(struct inode *i, struct file *f)
 {
 	struct scullp *s = container_of(i->i_cdev, struct scullp, cdev);
 
-	scullp_debug("opening %s", dev_name(&s->dev));
+	trace_ldd_op(dev_name(&s->dev), "open", 0, 0);
 
 	f->private_data = s;
 
@@ -241,7 +457,7 @@ static int scullp_release(struct inode *i, struct file *f)
 {
 	struct scullp *s = f->private_data;
 
-	scullp_debug("releasing %s", dev_name(&s->dev));
+	trace_ldd_op(dev_name(&s->dev), "release", 0, 0);
 
 	f->private_data = NULL;
 
@@ -249,8 +465,12 @@ static int scullp_release(struct inode *i, struct file *f)
 }
 
 static const struct file_operations scullp_ops = {
-	.read = scullp_read,
-	.write = scullp_write,
+	.read_iter = scullp_read_iter,
+	.write_iter = scullp_write_iter,
+	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
+	.unlocked_ioctl = scullp_ioctl,
+	.mmap = scullp_mmap,
 	.poll = scullp_poll,
 	.open = scullp_open,
 	.release = scullp_release,
@@ -258,23 +478,34 @@ static const struct file_operations scullp_ops = {
 
 static int __init scullp_initialize(struct scullp *s, const dev_t dev_base, int i)
 {
-	char name[SCULLP_DEV_NAME_LEN];
-
 	memset(&s->dev, 0, sizeof(s->dev));
 	device_initialize(&s->dev);
 	s->dev.devt = MKDEV(MAJOR(dev_base), MINOR(dev_base)+i);
-	sprintf(name, SCULLP_DEV_PREFIX "%d", i);
-	s->dev.init_name = name;
+	snprintf(s->name, sizeof(s->name), SCULLP_DEV_PREFIX "%d", i);
+	s->dev.init_name = s->name;
 	cdev_init(&s->cdev, &scullp_ops);
 	s->cdev.owner = THIS_MODULE;
 	init_waitqueue_head(&s->inwq);
 	init_waitqueue_head(&s->outwq);
-	mutex_init(&s->lock);
+	mutex_init(&s->rlock);
+	mutex_init(&s->wlock);
+	/* at least a byte, with the one slot empty */
+	if (scullp_buffer_size() < 2)
+		return -EINVAL;
 	s->size = scullp_buffer_size();
-	s->buffer = kzalloc(s->size, GFP_KERNEL);
-	if (!s->buffer)
+	/*
+	 * The control page followed by the buffer, which doesn't need
+	 * to be physically contiguous, and is mapped to the user space.
+	 */
+	s->ring = vmalloc_user(PAGE_SIZE + PAGE_ALIGN(s->size));
+	if (!s->ring)
 		return -ENOMEM;
-	s->readp = s->writep = 0;
+	s->ring->size = s->size;
+	s->rlowat = s->wlowat = 1;
+	s->timeout = 0;
+	atomic_set(&s->rshort, 0);
+	atomic_set(&s->wshort, 0);
+	s->buffer = (char *)s->ring + PAGE_SIZE;
 
 	return 0;
 }
@@ -285,10 +516,12 @@ static void scullp_terminate(struct scullp *s)
 		     MAJOR(s->dev.devt), MINOR(s->dev.devt));
 
 	cdev_device_del(&s->cdev, &s->dev);
-	if (s->buffer)
-		kfree(s->buffer);
+	unregister_ldd_stats(&s->stats);
+	if (s->ring)
+		vfree(s->ring);
+	s->ring = NULL;
 	s->buffer = NULL;
-	s->readp = s->writep = s->size = 0;
+	s->size = 0;
 }
 
 static int __init scullp_init(void)
@@ -311,15 +544,25 @@ static int __init scullp_init(void)
 	for (i = 0; i < nr_dev; i++, s++) {
 		err = scullp_initialize(s, dev_base, i);
 		if (err)
-			goto unregister;
-		err = cdev_device_add(&s->cdev, &s->dev);
+			goto free_ring;
+		/* latency histograms, before the device node shows up */
+		err = register_ldd_stats(&s->stats, dev_name(&s->dev));
 		if (err)
-			goto unregister;
+			goto free_ring;
+		err = cdev_device_add(&s->cdev, &s->dev);
+		if (err) {
+			unregister_ldd_stats(&s->stats);
+			goto free_ring;
+		}
 		scullp_debug("added %s[%d:%d]", dev_name(&s->dev),
 			     MAJOR(s->dev.devt), MINOR(s->dev.devt));
 	}
 	return 0;
-unregister:
+free_ring:
+	/* of the failed one, which isn't added */
+	if (s->ring)
+		vfree(s->ring);
+	s->ring = NULL;
 	s = scullps;
 	for (j = 0; j < i; j++, s++)
 		scullp_terminate(s);
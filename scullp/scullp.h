@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#ifndef _KERNEL_IN_ACTION_SCULLP_SCULLP_H
+#define _KERNEL_IN_ACTION_SCULLP_SCULLP_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * mmap(2) layout of the scullp device.
+ *
+ * The control page comes first at the offset 0, followed by the ring
+ * buffer at the offset of the page size, both shared with the read(2)
+ * and write(2) ends.  The consumer only moves readp and the producer
+ * only moves writep, with the release store after touching the data
+ * and the acquire load of the other end, keeping one slot empty to
+ * tell the full ring from the empty one.  Only a single consumer and
+ * a single producer are supported through the mapping, which kicks
+ * the other end with SCULLP_IOCKICK when the ring was empty or full.
+ */
+struct scullp_ring {
+	__u32	readp;		/* moved by the consumer */
+	__u32	__pad1[15];
+	__u32	writep;		/* moved by the producer */
+	__u32	__pad2[15];
+	__u32	size;		/* ring size in bytes, read only */
+};
+
+/* temporaly magic number. */
+#define SCULLP_IOC_MAGIC		0xfe
+
+/* wake up the other end, after moving the position through the mapping */
+#define SCULLP_IOCKICK			_IO(SCULLP_IOC_MAGIC, 0)
+
+/*
+ * The readers are woken up once rlowat bytes are readable, and the
+ * writers once wlowat bytes are writable, both 1 by default, or once
+ * the whole read(2) or write(2) shorter than the watermark can be
+ * done.  Those take what's there, even below the watermark, after the
+ * timeout in msec, 0 for no timeout.  poll(2) honors the watermarks
+ * as well.
+ */
+#define SCULLP_IOCSRLOWAT		_IOW(SCULLP_IOC_MAGIC, 1, int)
+#define SCULLP_IOCGRLOWAT		_IOR(SCULLP_IOC_MAGIC, 2, int)
+#define SCULLP_IOCSWLOWAT		_IOW(SCULLP_IOC_MAGIC, 3, int)
+#define SCULLP_IOCGWLOWAT		_IOR(SCULLP_IOC_MAGIC, 4, int)
+#define SCULLP_IOCSTIMEOUT		_IOW(SCULLP_IOC_MAGIC, 5, int)
+#define SCULLP_IOCGTIMEOUT		_IOR(SCULLP_IOC_MAGIC, 6, int)
+
+#define SCULLP_IOC_MAXNR		7
+
+#endif /* _KERNEL_IN_ACTION_SCULLP_SCULLP_H */
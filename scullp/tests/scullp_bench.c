@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+
+#define BENCH_NAME	"scullp_bench"
+#define MAX_THREADS	8
+
+/* shared by the producers and the consumers of the case */
+struct bench {
+	const char	*dev_name;
+	size_t		total;		/* bytes, produced and consumed */
+	size_t		chunk;
+	size_t		produced;	/* claimed by the producers */
+	size_t		consumed;
+	long		syscalls;
+	int		stop;
+};
+
+static struct utsname uts;
+
+/* tab separated kernel release, benchmark, case, metric and value */
+static void report(const char *name, const char *metric, double value)
+{
+	printf("%s\t%s\t%s\t%s\t%.3f\n", uts.release, BENCH_NAME, name,
+	       metric, value);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* to interrupt the consumers blocked in read(2), without SA_RESTART */
+static void interrupt(int signo)
+{
+}
+
+static void *producer(void *arg)
+{
+	struct bench *b = arg;
+	char buf[BUFSIZ];
+	size_t done, len;
+	long nr = 0;
+	int ret;
+	int fd;
+
+	fd = open(b->dev_name, O_WRONLY);
+	if (fd == -1)
+		return (void *)-1;
+	memset(buf, 'p', sizeof(buf));
+	for (;;) {
+		/* claim the next chunk, until the total is reached */
+		done = __atomic_fetch_add(&b->produced, b->chunk,
+					  __ATOMIC_RELAXED);
+		if (done >= b->total)
+			break;
+		len = b->total - done < b->chunk ? b->total - done : b->chunk;
+		while (len) {
+			ret = write(fd, buf, len);
+			nr++;
+			if (ret <= 0) {
+				close(fd);
+				return (void *)-1;
+			}
+			len -= ret;
+		}
+	}
+	__atomic_fetch_add(&b->syscalls, nr, __ATOMIC_RELAXED);
+	close(fd);
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct bench *b = arg;
+	char buf[BUFSIZ];
+	long nr = 0;
+	int ret;
+	int fd;
+
+	fd = open(b->dev_name, O_RDONLY);
+	if (fd == -1)
+		return (void *)-1;
+	while (!__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE)) {
+		ret = read(fd, buf, b->chunk);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		nr++;
+		if (ret <= 0) {
+			close(fd);
+			return (void *)-1;
+		}
+		__atomic_fetch_add(&b->consumed, ret, __ATOMIC_RELEASE);
+	}
+	__atomic_fetch_add(&b->syscalls, nr, __ATOMIC_RELAXED);
+	close(fd);
+	return NULL;
+}
+
+/* drain the leftover of the previous run */
+static int drain(const char *dev_name)
+{
+	char buf[BUFSIZ];
+	int fd;
+
+	fd = open(dev_name, O_RDONLY|O_NONBLOCK);
+	if (fd == -1)
+		return -1;
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	close(fd);
+	return 0;
+}
+
+static int producer_consumer_bench(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		int		producers;
+		int		consumers;
+		size_t		total;
+		size_t		chunk;
+	} tests[] = {
+		{
+			.name		= "1p1c-64B",
+			.dev_name	= "/dev/scullp0",
+			.producers	= 1,
+			.consumers	= 1,
+			.total		= 4*1024*1024,
+			.chunk		= 64,
+		},
+		{
+			.name		= "1p1c-4096B",
+			.dev_name	= "/dev/scullp0",
+			.producers	= 1,
+			.consumers	= 1,
+			.total		= 64*1024*1024,
+			.chunk		= 4096,
+		},
+		{
+			.name		= "2p2c-4096B",
+			.dev_name	= "/dev/scullp0",
+			.producers	= 2,
+			.consumers	= 2,
+			.total		= 64*1024*1024,
+			.chunk		= 4096,
+		},
+		{
+			.name		= "4p1c-4096B",
+			.dev_name	= "/dev/scullp0",
+			.producers	= 4,
+			.consumers	= 1,
+			.total		= 64*1024*1024,
+			.chunk		= 4096,
+		},
+		{
+			.name		= "4p4c-4096B",
+			.dev_name	= "/dev/scullp0",
+			.producers	= 4,
+			.consumers	= 4,
+			.total		= 64*1024*1024,
+			.chunk		= 4096,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		pthread_t producers[MAX_THREADS], consumers[MAX_THREADS];
+		struct bench b = {
+			.dev_name	= t->dev_name,
+			.total		= t->total,
+			.chunk		= t->chunk,
+		};
+		struct timespec ts;
+		int err = 0;
+		double start, elapsed;
+		void *ret;
+		int j;
+
+		fprintf(stderr, "%2d) %-70s", (*i)++, t->name);
+
+		if (drain(t->dev_name)) {
+			perror("open");
+			goto fail;
+		}
+		start = now();
+		for (j = 0; j < t->consumers; j++)
+			pthread_create(&consumers[j], NULL, consumer, &b);
+		for (j = 0; j < t->producers; j++)
+			pthread_create(&producers[j], NULL, producer, &b);
+		for (j = 0; j < t->producers; j++) {
+			pthread_join(producers[j], &ret);
+			if (ret)
+				err = -1;
+		}
+		while (!err && __atomic_load_n(&b.consumed, __ATOMIC_ACQUIRE) < t->total)
+			usleep(100);
+		elapsed = now() - start;
+
+		/* kick the consumers out of read(2), until those exit */
+		__atomic_store_n(&b.stop, 1, __ATOMIC_RELEASE);
+		for (j = 0; j < t->consumers; j++) {
+			do {
+				pthread_kill(consumers[j], SIGUSR1);
+				clock_gettime(CLOCK_REALTIME, &ts);
+				ts.tv_nsec += 10000000;
+				if (ts.tv_nsec >= 1000000000) {
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000;
+				}
+			} while (pthread_timedjoin_np(consumers[j], &ret, &ts));
+			if (ret)
+				err = -1;
+		}
+		if (err) {
+			fprintf(stderr, "producer or consumer failed\n");
+			goto fail;
+		}
+		report(t->name, "MB/s", t->total/elapsed/1e6);
+		report(t->name, "syscalls/s", b.syscalls/elapsed);
+		fprintf(stderr, "%10.1fMB/s\n", t->total/elapsed/1e6);
+		continue;
+fail:
+		fprintf(stderr, "FAIL\n");
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	struct sigaction sa = { .sa_handler = interrupt };
+	int fail = 0;
+	int i = 1;
+
+	uname(&uts);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	if (producer_consumer_bench(&i))
+		fail++;
+
+	return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
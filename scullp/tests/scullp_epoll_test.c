@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "kselftest.h"
+
+/* edge triggered epoll(7) on the read only and the write only fds */
+static int epoll_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		int		flags;
+		unsigned int	events;
+		size_t		len;
+		unsigned int	want_before;
+		unsigned int	want_after;
+	} tests[] = {
+		{
+			.name		= "EPOLLIN edge on read only fd",
+			.dev_name	= "/dev/scullp2",
+			.flags		= O_RDONLY|O_NONBLOCK,
+			.events		= EPOLLIN|EPOLLOUT|EPOLLET,
+			.len		= 1,
+			.want_before	= 0,
+			.want_after	= EPOLLIN,
+		},
+		{
+			.name		= "no EPOLLIN on write only fd",
+			.dev_name	= "/dev/scullp2",
+			.flags		= O_WRONLY|O_NONBLOCK,
+			.events		= EPOLLIN|EPOLLOUT|EPOLLET,
+			.len		= 1,
+			.want_before	= EPOLLOUT,
+			.want_after	= 0,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	char buf[BUFSIZ];
+	int fail = 0;
+
+	memset(buf, 'e', sizeof(buf));
+	for (t = tests; t->name; t++) {
+		struct epoll_event ev;
+		int fd = -1, wfd = -1, epfd = -1;
+		int ret;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		fd = open(t->dev_name, t->flags);
+		wfd = open(t->dev_name, O_RDWR|O_NONBLOCK);
+		epfd = epoll_create1(0);
+		if (fd == -1 || wfd == -1 || epfd == -1) {
+			perror("open");
+			goto fail;
+		}
+		while (read(wfd, buf, sizeof(buf)) > 0)
+			; /* drain the leftover */
+		ev.events = t->events;
+		ev.data.fd = fd;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			perror("epoll_ctl");
+			goto fail;
+		}
+
+		/* initial state */
+		ret = epoll_wait(epfd, &ev, 1, 0);
+		if ((ret ? ev.events : 0) != t->want_before) {
+			printf("%d=epoll_wait() events=0x%x before write\n",
+			       ret, ret ? ev.events : 0);
+			goto fail;
+		}
+
+		/* edge on the write */
+		if (write(wfd, buf, t->len) != t->len) {
+			perror("write");
+			goto fail;
+		}
+		ret = epoll_wait(epfd, &ev, 1, 100);
+		if ((ret ? ev.events : 0) != t->want_after) {
+			printf("%d=epoll_wait() events=0x%x after write\n",
+			       ret, ret ? ev.events : 0);
+			goto fail;
+		}
+
+		/* no more edge without the new data */
+		ret = epoll_wait(epfd, &ev, 1, 0);
+		if (ret) {
+			printf("%d=epoll_wait() events=0x%x without edge\n",
+			       ret, ev.events);
+			goto fail;
+		}
+		while (read(wfd, buf, sizeof(buf)) > 0)
+			;
+		close(epfd);
+		close(wfd);
+		close(fd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail:
+		if (epfd != -1)
+			close(epfd);
+		if (wfd != -1)
+			close(wfd);
+		if (fd != -1)
+			close(fd);
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	if (epoll_test(&i))
+		fail++;
+
+	puts("");
+	if (fail)
+		ksft_exit_fail();
+	else
+		ksft_exit_pass();
+}
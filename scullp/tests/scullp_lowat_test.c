@@ -0,0 +1,276 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../scullp.h"
+
+#include "kselftest.h"
+
+static int lowat_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		int		rlowat;
+		int		timeout;
+		size_t		below;
+	} tests[] = {
+		{
+			.name		= "100 bytes read watermark without timeout",
+			.dev_name	= "/dev/scullp3",
+			.rlowat		= 100,
+			.timeout	= 0,
+			.below		= 99,
+		},
+		{
+			.name		= "1000 bytes read watermark with 100ms timeout",
+			.dev_name	= "/dev/scullp3",
+			.rlowat		= 1000,
+			.timeout	= 100,
+			.below		= 10,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	char buf[BUFSIZ];
+	int fail = 0;
+
+	memset(buf, 'w', sizeof(buf));
+	for (t = tests; t->name; t++) {
+		struct pollfd pfd;
+		int rfd = -1, wfd = -1;
+		int val, ret;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		wfd = open(t->dev_name, O_WRONLY|O_NONBLOCK);
+		rfd = open(t->dev_name, O_RDONLY|O_NONBLOCK);
+		if (wfd == -1 || rfd == -1) {
+			perror("open");
+			goto fail;
+		}
+		while (read(rfd, buf, sizeof(buf)) > 0)
+			; /* drain the leftover */
+		if (ioctl(rfd, SCULLP_IOCSRLOWAT, &t->rlowat) == -1 ||
+		    ioctl(rfd, SCULLP_IOCSTIMEOUT, &t->timeout) == -1) {
+			perror("ioctl");
+			goto fail;
+		}
+		if (ioctl(rfd, SCULLP_IOCGRLOWAT, &val) == -1 ||
+		    val != t->rlowat) {
+			printf("%d=ioctl(SCULLP_IOCGRLOWAT) != %d\n", val, t->rlowat);
+			goto fail;
+		}
+
+		/* not readable below the watermark */
+		if (write(wfd, buf, t->below) != t->below) {
+			perror("write");
+			goto fail;
+		}
+		pfd.fd = rfd;
+		pfd.events = POLLIN;
+		ret = poll(&pfd, 1, 0);
+		if (ret != 0) {
+			printf("%d=poll() below the watermark\n", ret);
+			goto fail;
+		}
+
+		if (t->timeout) {
+			/* blocking read takes what's there after the timeout */
+			fcntl(rfd, F_SETFL, fcntl(rfd, F_GETFL)&~O_NONBLOCK);
+			ret = read(rfd, buf, sizeof(buf));
+			if (ret != t->below) {
+				printf("%d=read() after the timeout\n", ret);
+				goto fail;
+			}
+		} else {
+			/* readable at the watermark */
+			if (write(wfd, buf, t->rlowat - t->below) !=
+			    t->rlowat - t->below) {
+				perror("write");
+				goto fail;
+			}
+			ret = poll(&pfd, 1, 0);
+			if (ret != 1 || !(pfd.revents & POLLIN)) {
+				printf("%d=poll() at the watermark\n", ret);
+				goto fail;
+			}
+			ret = read(rfd, buf, sizeof(buf));
+			if (ret != t->rlowat) {
+				printf("%d=read() at the watermark\n", ret);
+				goto fail;
+			}
+		}
+		val = 1;
+		ioctl(rfd, SCULLP_IOCSRLOWAT, &val);
+		val = 0;
+		ioctl(rfd, SCULLP_IOCSTIMEOUT, &val);
+		close(rfd);
+		close(wfd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail:
+		if (rfd != -1) {
+			/* back to the default */
+			val = 1;
+			ioctl(rfd, SCULLP_IOCSRLOWAT, &val);
+			val = 0;
+			ioctl(rfd, SCULLP_IOCSTIMEOUT, &val);
+			close(rfd);
+		}
+		if (wfd != -1)
+			close(wfd);
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	return fail;
+}
+
+/* the blocking read(2) or write(2) of 1 byte, in the child */
+static pid_t short_io(const char *dev_name, int write_op)
+{
+	char buf[1] = { 'w' };
+	pid_t pid;
+	int fd;
+
+	pid = fork();
+	if (pid)
+		return pid;
+	alarm(1); /* killed, if not woken up */
+	fd = open(dev_name, write_op ? O_WRONLY : O_RDONLY);
+	if (fd == -1)
+		_exit(EXIT_FAILURE);
+	if ((write_op ? write(fd, buf, 1) : read(fd, buf, 1)) != 1)
+		_exit(EXIT_FAILURE);
+	close(fd);
+	_exit(EXIT_SUCCESS);
+}
+
+static int short_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		int		write_op;	/* blocked writer, or reader */
+		unsigned long	cmd;
+		int		lowat;
+	} tests[] = {
+		{
+			.name		= "1 byte read below 4000 bytes read watermark",
+			.dev_name	= "/dev/scullp3",
+			.cmd		= SCULLP_IOCSRLOWAT,
+			.lowat		= 4000,
+		},
+		{
+			.name		= "1 byte write below 4000 bytes write watermark",
+			.dev_name	= "/dev/scullp3",
+			.write_op	= 1,
+			.cmd		= SCULLP_IOCSWLOWAT,
+			.lowat		= 4000,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	char buf[BUFSIZ];
+	int fail = 0;
+
+	memset(buf, 'w', sizeof(buf));
+	for (t = tests; t->name; t++) {
+		int rfd = -1, wfd = -1;
+		pid_t pid = -1;
+		int status;
+		int val;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		wfd = open(t->dev_name, O_WRONLY|O_NONBLOCK);
+		rfd = open(t->dev_name, O_RDONLY|O_NONBLOCK);
+		if (wfd == -1 || rfd == -1) {
+			perror("open");
+			goto fail;
+		}
+		while (read(rfd, buf, sizeof(buf)) > 0)
+			; /* drain the leftover */
+
+		/* no space left for the writer */
+		if (t->write_op)
+			while (write(wfd, buf, sizeof(buf)) > 0)
+				;
+		if (ioctl(rfd, t->cmd, &t->lowat) == -1) {
+			perror("ioctl");
+			goto fail;
+		}
+		pid = short_io(t->dev_name, t->write_op);
+		usleep(100000); /* let it sleep */
+
+		/* a single byte is all it needs */
+		if ((t->write_op ? read(rfd, buf, 1) : write(wfd, buf, 1)) != 1) {
+			perror(t->write_op ? "read" : "write");
+			goto fail;
+		}
+		if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != EXIT_SUCCESS) {
+			puts("not woken up");
+			pid = -1;
+			goto fail;
+		}
+		pid = -1;
+		val = 1;
+		ioctl(rfd, t->cmd, &val);
+		while (read(rfd, buf, sizeof(buf)) > 0)
+			;
+		close(rfd);
+		close(wfd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail:
+		if (pid > 0) {
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+		}
+		if (rfd != -1) {
+			/* back to the default */
+			val = 1;
+			ioctl(rfd, t->cmd, &val);
+			while (read(rfd, buf, sizeof(buf)) > 0)
+				;
+			close(rfd);
+		}
+		if (wfd != -1)
+			close(wfd);
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	if (lowat_test(&i))
+		fail++;
+	if (short_test(&i))
+		fail++;
+
+	puts("");
+	if (fail)
+		ksft_exit_fail();
+	else
+		ksft_exit_pass();
+}
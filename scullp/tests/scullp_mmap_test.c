@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+#include "../scullp.h"
+
+#include "kselftest.h"
+
+#define SCULLP_BUFFER_SIZE_PARAM	"/sys/module/scullp/parameters/buffer_size"
+
+static int buffer_size(void)
+{
+	char buf[BUFSIZ];
+	int ret;
+	int fd;
+
+	fd = open(SCULLP_BUFFER_SIZE_PARAM, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	ret = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+	return atoi(buf);
+}
+
+/* exchange the data between the mapping and the read(2)/write(2) end */
+static int mmap_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		size_t		len;
+	} tests[] = {
+		{
+			.name		= "write(2) 1 byte and consume it through mmap(2)",
+			.dev_name	= "/dev/scullp2",
+			.len		= 1,
+		},
+		{
+			.name		= "write(2) 1000 bytes and consume those through mmap(2)",
+			.dev_name	= "/dev/scullp2",
+			.len		= 1000,
+		},
+		{
+			.name		= "write(2) 4000 bytes and consume those through mmap(2)",
+			.dev_name	= "/dev/scullp3",
+			.len		= 4000,
+		},
+		{ /* sentry */ },
+	};
+	long page_size = sysconf(_SC_PAGESIZE);
+	const struct test *t;
+	char buf[BUFSIZ];
+	size_t map_size;
+	int fail = 0;
+	int size;
+
+	size = buffer_size();
+	if (size < 2) {
+		printf("%2d) %-70sFAIL\n", (*i)++, "can't read buffer_size");
+		ksft_inc_fail_cnt();
+		return 1;
+	}
+	map_size = page_size + (size + page_size - 1)/page_size*page_size;
+
+	for (t = tests; t->name; t++) {
+		struct scullp_ring *ring = MAP_FAILED;
+		unsigned int pos;
+		char *data;
+		size_t j;
+		int fd;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		fd = open(t->dev_name, O_RDWR|O_NONBLOCK);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+		while (read(fd, buf, sizeof(buf)) > 0)
+			; /* drain the leftover */
+		ring = mmap(NULL, map_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+			    fd, 0);
+		if (ring == MAP_FAILED) {
+			perror("mmap");
+			goto fail_close;
+		}
+		data = (char *)ring + page_size;
+		if (ring->size != size) {
+			printf("ring size %u != %d\n", ring->size, size);
+			goto fail_close;
+		}
+
+		/* producer is write(2), consumer is the mapping */
+		for (j = 0; j < t->len; j++)
+			buf[j] = 'a' + j%26;
+		if (write(fd, buf, t->len) != t->len) {
+			perror("write");
+			goto fail_close;
+		}
+		pos = __atomic_load_n(&ring->readp, __ATOMIC_RELAXED);
+		j = __atomic_load_n(&ring->writep, __ATOMIC_ACQUIRE);
+		if ((j + size - pos)%size != t->len) {
+			puts("writep didn't move");
+			goto fail_close;
+		}
+		for (j = 0; j < t->len; j++)
+			if (data[(pos + j)%size] != buf[j])
+				break;
+		if (j != t->len) {
+			puts("data mismatch on the mapping");
+			goto fail_close;
+		}
+		__atomic_store_n(&ring->readp, (pos + t->len)%size,
+				 __ATOMIC_RELEASE);
+		if (ioctl(fd, SCULLP_IOCKICK) == -1) {
+			perror("ioctl(SCULLP_IOCKICK)");
+			goto fail_close;
+		}
+		if (read(fd, buf, sizeof(buf)) != -1 || errno != EAGAIN) {
+			puts("data left after consumed on the mapping");
+			goto fail_close;
+		}
+
+		/* producer is the mapping, consumer is read(2) */
+		pos = __atomic_load_n(&ring->writep, __ATOMIC_RELAXED);
+		for (j = 0; j < t->len; j++)
+			data[(pos + j)%size] = 'A' + j%26;
+		__atomic_store_n(&ring->writep, (pos + t->len)%size,
+				 __ATOMIC_RELEASE);
+		if (ioctl(fd, SCULLP_IOCKICK) == -1) {
+			perror("ioctl(SCULLP_IOCKICK)");
+			goto fail_close;
+		}
+		if (read(fd, buf, sizeof(buf)) != t->len) {
+			perror("read");
+			goto fail_close;
+		}
+		for (j = 0; j < t->len; j++)
+			if (buf[j] != 'A' + j%26)
+				break;
+		if (j != t->len) {
+			puts("data mismatch on read(2)");
+			goto fail_close;
+		}
+		munmap(ring, map_size);
+		close(fd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail_close:
+		if (ring != MAP_FAILED)
+			munmap(ring, map_size);
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	if (mmap_test(&i))
+		fail++;
+
+	puts("");
+	if (fail)
+		ksft_exit_fail();
+	else
+		ksft_exit_pass();
+}
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "kselftest.h"
+
+#define SCULLP_BUFFER_SIZE_PARAM	"/sys/module/scullp/parameters/buffer_size"
+
+static int buffer_size(void)
+{
+	char buf[BUFSIZ];
+	int ret;
+	int fd;
+
+	fd = open(SCULLP_BUFFER_SIZE_PARAM, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	ret = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+	return atoi(buf);
+}
+
+/* the single call fills and drains the whole ring, even wrapped */
+static int wraparound_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		size_t		offset;
+	} tests[] = {
+		{
+			.name		= "fill and drain the ring in a single call",
+			.dev_name	= "/dev/scullp2",
+			.offset		= 0,
+		},
+		{
+			.name		= "fill and drain the ring wrapped at 1 byte",
+			.dev_name	= "/dev/scullp2",
+			.offset		= 1,
+		},
+		{
+			.name		= "fill and drain the ring wrapped at 1000 bytes",
+			.dev_name	= "/dev/scullp3",
+			.offset		= 1000,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	char *wbuf, *rbuf;
+	int fail = 0;
+	int size;
+
+	size = buffer_size();
+	if (size < 2) {
+		printf("%2d) %-70sFAIL\n", (*i)++, "can't read buffer_size");
+		ksft_inc_fail_cnt();
+		return 1;
+	}
+	wbuf = malloc(size);
+	rbuf = malloc(size);
+
+	for (t = tests; t->name; t++) {
+		size_t j;
+		int ret;
+		int fd;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		for (j = 0; j < size; j++)
+			wbuf[j] = 'a' + j%26;
+		memset(rbuf, 'r', size);
+
+		fd = open(t->dev_name, O_RDWR|O_NONBLOCK);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+
+		/* drain the leftover, then move the ring positions */
+		while (read(fd, rbuf, size) > 0)
+			;
+		if (t->offset) {
+			if (write(fd, wbuf, t->offset) != t->offset ||
+			    read(fd, rbuf, t->offset) != t->offset) {
+				perror("offset");
+				goto fail_close;
+			}
+		}
+
+		/* one slot is always kept empty */
+		ret = write(fd, wbuf, size);
+		if (ret != size - 1) {
+			printf("%d=write(%d): %s\n", ret, size, strerror(errno));
+			goto fail_close;
+		}
+		ret = read(fd, rbuf, size);
+		if (ret != size - 1) {
+			printf("%d=read(%d): %s\n", ret, size, strerror(errno));
+			goto fail_close;
+		}
+		if (memcmp(wbuf, rbuf, size - 1)) {
+			puts("data mismatch");
+			goto fail_close;
+		}
+		close(fd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail_close:
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	free(wbuf);
+	free(rbuf);
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	if (wraparound_test(&i))
+		fail++;
+
+	puts("");
+	if (fail)
+		ksft_exit_fail();
+	else
+		ksft_exit_pass();
+}
@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "kselftest.h"
+
+/* pipe -> scullp -> pipe round trip, without the user buffer */
+static int splice_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		size_t		len;
+	} tests[] = {
+		{
+			.name		= "splice 1 byte in and out of /dev/scullp2",
+			.dev_name	= "/dev/scullp2",
+			.len		= 1,
+		},
+		{
+			.name		= "splice 1024 bytes in and out of /dev/scullp2",
+			.dev_name	= "/dev/scullp2",
+			.len		= 1024,
+		},
+		{
+			.name		= "splice 4000 bytes in and out of /dev/scullp3",
+			.dev_name	= "/dev/scullp3",
+			.len		= 4000,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	char wbuf[BUFSIZ], rbuf[BUFSIZ];
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		int pfd[2] = {-1, -1};
+		ssize_t ret;
+		size_t j;
+		int fd;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		for (j = 0; j < t->len; j++)
+			wbuf[j] = 'a' + j%26;
+		memset(rbuf, 'r', t->len);
+
+		fd = open(t->dev_name, O_RDWR|O_NONBLOCK);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+		while (read(fd, rbuf, sizeof(rbuf)) > 0)
+			; /* drain the leftover */
+		if (pipe(pfd) == -1) {
+			perror("pipe");
+			goto fail_close;
+		}
+		if (write(pfd[1], wbuf, t->len) != t->len) {
+			perror("write");
+			goto fail_close;
+		}
+		ret = splice(pfd[0], NULL, fd, NULL, t->len, 0);
+		if (ret != t->len) {
+			printf("%ld=splice(pipe->%s): %s\n", ret, t->dev_name,
+			       strerror(errno));
+			goto fail_close;
+		}
+		ret = splice(fd, NULL, pfd[1], NULL, t->len, 0);
+		if (ret != t->len) {
+			printf("%ld=splice(%s->pipe): %s\n", ret, t->dev_name,
+			       strerror(errno));
+			goto fail_close;
+		}
+		if (read(pfd[0], rbuf, t->len) != t->len) {
+			perror("read");
+			goto fail_close;
+		}
+		if (memcmp(wbuf, rbuf, t->len)) {
+			puts("data mismatch");
+			goto fail_close;
+		}
+		close(pfd[0]);
+		close(pfd[1]);
+		close(fd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail_close:
+		if (pfd[0] != -1)
+			close(pfd[0]);
+		if (pfd[1] != -1)
+			close(pfd[1]);
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	if (splice_test(&i))
+		fail++;
+
+	puts("");
+	if (fail)
+		ksft_exit_fail();
+	else
+		ksft_exit_pass();
+}
@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "kselftest.h"
+
+/* the writer process, which writes the byte sequence in chunks */
+static int writer(const char *dev_name, size_t total, size_t chunk)
+{
+	unsigned char buf[BUFSIZ];
+	size_t done, len, j;
+	int ret;
+	int fd;
+
+	fd = open(dev_name, O_WRONLY);
+	if (fd == -1)
+		return EXIT_FAILURE;
+	for (done = 0; done < total; done += ret) {
+		len = total - done < chunk ? total - done : chunk;
+		for (j = 0; j < len; j++)
+			buf[j] = (done + j) % 251;
+		ret = write(fd, buf, len);
+		if (ret <= 0) {
+			close(fd);
+			return EXIT_FAILURE;
+		}
+	}
+	close(fd);
+	return EXIT_SUCCESS;
+}
+
+static int spsc_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*dev_name;
+		size_t		total;
+		size_t		wchunk;
+		size_t		rchunk;
+	} tests[] = {
+		{
+			.name		= "16KiB in 1 byte writes and 4096 bytes reads",
+			.dev_name	= "/dev/scullp2",
+			.total		= 16*1024,
+			.wchunk		= 1,
+			.rchunk		= 4096,
+		},
+		{
+			.name		= "16KiB in 4096 bytes writes and 1 byte reads",
+			.dev_name	= "/dev/scullp2",
+			.total		= 16*1024,
+			.wchunk		= 4096,
+			.rchunk		= 1,
+		},
+		{
+			.name		= "16MiB in 1000 bytes writes and 3000 bytes reads",
+			.dev_name	= "/dev/scullp3",
+			.total		= 16*1024*1024,
+			.wchunk		= 1000,
+			.rchunk		= 3000,
+		},
+		{
+			.name		= "16MiB in 4096 bytes writes and reads",
+			.dev_name	= "/dev/scullp3",
+			.total		= 16*1024*1024,
+			.wchunk		= 4096,
+			.rchunk		= 4096,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	unsigned char buf[BUFSIZ];
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		size_t done, j;
+		int status;
+		pid_t pid;
+		int ret;
+		int fd;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		fd = open(t->dev_name, O_RDONLY);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+		pid = fork();
+		if (pid == -1) {
+			perror("fork");
+			goto fail_close;
+		} else if (pid == 0)
+			exit(writer(t->dev_name, t->total, t->wchunk));
+
+		/* read it back concurrently, in order */
+		for (done = 0; done < t->total; done += ret) {
+			ret = read(fd, buf, t->rchunk);
+			if (ret <= 0) {
+				perror("read");
+				goto fail_wait;
+			}
+			for (j = 0; j < ret; j++)
+				if (buf[j] != (done + j) % 251)
+					break;
+			if (j != ret) {
+				printf("data mismatch at %ld\n", done + j);
+				goto fail_wait;
+			}
+		}
+		if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != EXIT_SUCCESS) {
+			puts("writer failed");
+			goto fail_close;
+		}
+		close(fd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail_wait:
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+fail_close:
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	if (spsc_test(&i))
+		fail++;
+
+	puts("");
+	if (fail)
+		ksft_exit_fail();
+	else
+		ksft_exit_pass();
+}
@@ -2,18 +2,29 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/moduleparam.h>
 #include <linux/device.h>
 #include <linux/string.h>
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/kdev_t.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/numa.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+#include <linux/radix-tree.h>
+#include <linux/uio.h>
 
 #include "../ldd/ldd.h"
+#include "../ldd/trace.h"
 
 #define SCULLPM_DRIVER_NAME	"scullpm"
-#define SCULLPM_DRIVER_VERSION	"1.0.0"
+#define SCULLPM_DRIVER_VERSION	"1.4.0"
 #define SCULLPM_DEVICE_PREFIX	SCULLPM_DRIVER_NAME
+#define SCULLPM_DEFAULT_ORDER	0
 
 /* driver */
 static struct scullpm_driver {
@@ -27,7 +38,14 @@ static struct scullpm_driver {
 
 /* devices */
 static struct scullpm_device {
-	struct mutex		lock;
+	struct rw_semaphore	sem;	/* read for I/O, write for trim */
+	struct mutex		lock;	/* page index, order and size */
+	size_t			size;
+	int			order;	/* order of each page block */
+	int			node;	/* NUMA_NO_NODE for the first writer's */
+	unsigned long		nr_pages;	/* resident pages */
+	struct radix_tree_root	pages;	/* blocks indexed by the block number */
+	struct ldd_stats	stats;
 	struct cdev		cdev;
 	struct ldd_device	ldd;
 } devices[] = {
@@ -35,34 +53,292 @@ static struct scullpm_device {
 	{ .ldd.name	= SCULLPM_DEVICE_PREFIX "1" },
 	{ /* sentinel */ },
 };
+#define NR_SCULLPM_DEV		(ARRAY_SIZE(devices)-1)
 #define to_scullpm_device(_dev)	container_of(to_ldd_device(_dev), struct scullpm_device, ldd)
 
-static ssize_t read(struct file *f, char __user *buf, size_t n, loff_t *pos)
+static int page_order = SCULLPM_DEFAULT_ORDER;
+static int numa_node = NUMA_NO_NODE;
+module_param(page_order, int, S_IRUGO);
+module_param(numa_node, int, S_IRUGO);
+
+static inline size_t block_size(const struct scullpm_device *d)
+{
+	return PAGE_SIZE << d->order;
+}
+
+/*
+ * find the page block, or allocate it when alloc is set, with d->lock
+ * held.  The high order blocks are compound, so that each page of the
+ * block can be mapped and reference counted on its own.
+ *
+ * The blocks come from the device node, which is the node of the
+ * first writer unless pinned through the numa_node attribute.  The
+ * allocator still falls back to the other nodes under the pressure.
+ */
+static struct page *find_block(struct scullpm_device *d, unsigned long idx,
+			       int alloc)
+{
+	gfp_t gfp = GFP_KERNEL|__GFP_ZERO;
+	struct page *page;
+	int nid;
+	int err;
+
+	page = radix_tree_lookup(&d->pages, idx);
+	if (page || !alloc)
+		return page;
+
+	nid = dev_to_node(&d->ldd.dev);
+	if (nid == NUMA_NO_NODE) {
+		nid = numa_mem_id();
+		set_dev_node(&d->ldd.dev, nid);
+	}
+	if (d->order)
+		gfp |= __GFP_COMP|__GFP_NOWARN;
+	page = alloc_pages_node(nid, gfp, d->order);
+	if (!page)
+		return ERR_PTR(-ENOMEM);
+	err = radix_tree_insert(&d->pages, idx, page);
+	if (err) {
+		__free_pages(page, d->order);
+		return ERR_PTR(err);
+	}
+	d->nr_pages += 1 << d->order;
+	return page;
+}
+
+/* same as find_block(), but d->lock is only held for the lookup */
+static struct page *get_block(struct scullpm_device *d, unsigned long idx,
+			      int alloc)
+{
+	struct page *page;
+
+	mutex_lock(&d->lock);
+	page = find_block(d, idx, alloc);
+	mutex_unlock(&d->lock);
+	return page;
+}
+
+/* free the blocks, after zapping the user mappings, if any */
+static void trim_blocks(struct scullpm_device *d, struct address_space *mapping)
+{
+	struct radix_tree_iter iter;
+	void **slot;
+
+	mutex_lock(&d->lock);
+	if (mapping)
+		unmap_mapping_range(mapping, 0, 0, 1);
+	radix_tree_for_each_slot(slot, &d->pages, &iter, 0) {
+		struct page *page = radix_tree_deref_slot(slot);
+		radix_tree_iter_delete(&d->pages, &iter, slot);
+		/* the last reference, unless pinned by someone else */
+		__free_pages(page, d->order);
+	}
+	d->nr_pages = 0;
+	d->size = 0;
+	set_dev_node(&d->ldd.dev, d->node);
+	mutex_unlock(&d->lock);
+}
+
+static ssize_t read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct scullpm_device *d = iocb->ki_filp->private_data;
+	size_t n = iov_iter_count(to);
+	size_t done, len, copied;
+	size_t bsize, off;
+	unsigned long idx;
+	struct page *page;
+	size_t size;
+	ssize_t ret;
+	u64 start;
+
+	/* readers run in parallel, only excluded by trim */
+	start = ldd_stats_start();
+	down_read(&d->sem);
+	ldd_stats_end(&d->stats, LDD_LAT_LOCK, start);
+
+	/* no more data to read */
+	ret = 0;
+	size = READ_ONCE(d->size);
+	if (iocb->ki_pos >= size)
+		goto out;
+	if (n > size-iocb->ki_pos)
+		n = size-iocb->ki_pos;
+
+	/* the order is stable, as it only changes with d->sem held */
+	bsize = block_size(d);
+	idx = iocb->ki_pos >> (PAGE_SHIFT+d->order);
+	off = iocb->ki_pos & (bsize-1);
+
+	/* copy to the iovecs, block by block */
+	for (done = 0; done < n; done += copied) {
+		len = min(n-done, bsize-off);
+		page = get_block(d, idx++, 0);
+		start = ldd_stats_start();
+		if (page)
+			copied = copy_page_to_iter(page, off, len, to);
+		else
+			copied = iov_iter_zero(len, to); /* hole */
+		ldd_stats_end(&d->stats, LDD_LAT_COPY, start);
+		if (copied != len) {
+			done += copied;
+			ret = -EFAULT;
+			break;
+		}
+		off = 0;
+	}
+	/* partial read on fault */
+	if (done) {
+		iocb->ki_pos += done;
+		ret = done;
+	}
+out:
+	up_read(&d->sem);
+	trace_ldd_op(ldd_dev_name(&d->ldd), "read", n, ret);
+	return ret;
+}
+
+/*
+ * The writers run in parallel as well.  The writes to the same range
+ * are not atomic against each other, same as through the mapping.
+ */
+static ssize_t write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-	return -ENOTTY;
+	struct scullpm_device *d = iocb->ki_filp->private_data;
+	size_t n = iov_iter_count(from);
+	size_t done, len, copied;
+	size_t bsize, off;
+	unsigned long idx;
+	struct page *page;
+	ssize_t ret;
+	u64 start;
+
+	start = ldd_stats_start();
+	down_read(&d->sem);
+	ldd_stats_end(&d->stats, LDD_LAT_LOCK, start);
+
+	bsize = block_size(d);
+	idx = iocb->ki_pos >> (PAGE_SHIFT+d->order);
+	off = iocb->ki_pos & (bsize-1);
+
+	/* copy from the iovecs, block by block */
+	ret = 0;
+	for (done = 0; done < n; done += copied) {
+		len = min(n-done, bsize-off);
+		page = get_block(d, idx++, 1);
+		if (IS_ERR(page)) {
+			ret = PTR_ERR(page);
+			break;
+		}
+		start = ldd_stats_start();
+		copied = copy_page_from_iter(page, off, len, from);
+		ldd_stats_end(&d->stats, LDD_LAT_COPY, start);
+		if (copied != len) {
+			done += copied;
+			ret = -EFAULT;
+			break;
+		}
+		off = 0;
+	}
+	/* partial write on error */
+	if (done) {
+		iocb->ki_pos += done;
+		ret = done;
+		mutex_lock(&d->lock);
+		if (iocb->ki_pos > d->size)
+			WRITE_ONCE(d->size, iocb->ki_pos);
+		mutex_unlock(&d->lock);
+	}
+	up_read(&d->sem);
+	trace_ldd_op(ldd_dev_name(&d->ldd), "write", n, ret);
+	return ret;
 }
 
-static ssize_t write(struct file *f, const char __user *buf, size_t n, loff_t *pos)
+static loff_t llseek(struct file *f, loff_t off, int whence)
 {
-	return -ENOTTY;
+	struct scullpm_device *d = f->private_data;
+
+	return generic_file_llseek_size(f, off, whence, MAX_LFS_FILESIZE,
+					READ_ONCE(d->size));
 }
 
 static int open(struct inode *i, struct file *f)
 {
 	struct scullpm_device *d = container_of(i->i_cdev, struct scullpm_device, cdev);
+
+	trace_ldd_op(ldd_dev_name(&d->ldd), "open", 0, 0);
+
+	/* trim the pages when it opened write only with trunk option */
+	if ((f->f_flags&O_ACCMODE) == O_WRONLY && f->f_flags&O_TRUNC) {
+		if (down_write_killable(&d->sem))
+			return -ERESTARTSYS;
+		trim_blocks(d, f->f_mapping);
+		up_write(&d->sem);
+	}
 	f->private_data = d;
 	return 0;
 }
 
 static int release(struct inode *i, struct file *f)
 {
+	struct scullpm_device *d = f->private_data;
+
+	trace_ldd_op(ldd_dev_name(&d->ldd), "release", 0, 0);
 	f->private_data = NULL;
 	return 0;
 }
 
+static vm_fault_t fault(struct vm_fault *vmf)
+{
+	struct scullpm_device *d = vmf->vma->vm_file->private_data;
+	loff_t off = (loff_t)vmf->pgoff << PAGE_SHIFT;
+	struct page *page;
+	vm_fault_t ret;
+
+	/* d->lock keeps the order stable against the sysfs update */
+	mutex_lock(&d->lock);
+
+	/*
+	 * no read beyond the end, same as the regular file.  The write
+	 * through the mapping extends the device to the end of the page,
+	 * and the holes within the size are filled, as the shared
+	 * mapping needs the real page behind it.
+	 */
+	ret = VM_FAULT_SIGBUS;
+	if (!(vmf->flags & FAULT_FLAG_WRITE) && off >= d->size)
+		goto out;
+	page = find_block(d, vmf->pgoff >> d->order, 1);
+	ret = VM_FAULT_OOM;
+	if (IS_ERR(page))
+		goto out;
+	if (vmf->flags & FAULT_FLAG_WRITE && off + PAGE_SIZE > d->size)
+		WRITE_ONCE(d->size, off + PAGE_SIZE);
+
+	/* the reference will be dropped on unmap */
+	vmf->page = page + (vmf->pgoff & ((1UL << d->order)-1));
+	get_page(vmf->page);
+	ret = 0;
+out:
+	mutex_unlock(&d->lock);
+	return ret;
+}
+
+static const struct vm_operations_struct vm_ops = {
+	.fault		= fault,
+};
+
+static int mmap(struct file *f, struct vm_area_struct *vma)
+{
+	vma->vm_ops = &vm_ops;
+	vma->vm_flags |= VM_DONTEXPAND|VM_DONTDUMP;
+	return 0;
+}
+
 static const struct file_operations fops = {
-	.read		= read,
-	.write		= write,
+	.owner		= THIS_MODULE,
+	.llseek		= llseek,
+	.read_iter	= read_iter,
+	.write_iter	= write_iter,
+	.mmap		= mmap,
 	.open		= open,
 	.release	= release,
 };
@@ -73,7 +349,7 @@ static ssize_t show_major_number(struct device *dev,
 	return snprintf(buf, PAGE_SIZE, "%d\n", MAJOR(dev->devt));
 }
 
-static const struct device_attribute major_attr = {
+static struct device_attribute major_attr = {
 	.attr.name	= "major_number",
 	.attr.mode	= S_IRUGO,
 	.show		= show_major_number,
@@ -85,54 +361,163 @@ static ssize_t show_minor_number(struct device *dev,
 	return snprintf(buf, PAGE_SIZE, "%d\n", MINOR(dev->devt));
 }
 
-static const struct device_attribute minor_attr = {
+static struct device_attribute minor_attr = {
 	.attr.name	= "minor_number",
 	.attr.mode	= S_IRUGO,
 	.show		= show_minor_number,
 };
 
-static int register_device(struct scullpm_device *d, dev_t devt)
+static ssize_t show_page_order(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct scullpm_device *d = to_scullpm_device(dev);
+	return snprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(d->order));
+}
+
+/* only the empty device changes the order, as the blocks are indexed by it */
+static ssize_t store_page_order(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
 {
+	struct scullpm_device *d = to_scullpm_device(dev);
+	int order;
 	int err;
 
-	/* for /dev/scullpmX */
-	d->ldd.dev.devt = devt;
-	err = register_ldd_device(&d->ldd);
+	err = kstrtoint(buf, 10, &order);
 	if (err)
 		return err;
+	if (order < 0 || order >= MAX_ORDER)
+		return -EINVAL;
+
+	down_write(&d->sem);
+	mutex_lock(&d->lock);
+	err = -EBUSY;
+	if (!d->nr_pages) {
+		WRITE_ONCE(d->order, order);
+		err = 0;
+	}
+	mutex_unlock(&d->lock);
+	up_write(&d->sem);
+	return err ? err : count;
+}
+
+static struct device_attribute page_order_attr = {
+	.attr.name	= "page_order",
+	.attr.mode	= S_IRUGO|S_IWUSR,
+	.show		= show_page_order,
+	.store		= store_page_order,
+};
+
+static ssize_t show_resident_pages(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct scullpm_device *d = to_scullpm_device(dev);
+	return snprintf(buf, PAGE_SIZE, "%lu\n", READ_ONCE(d->nr_pages));
+}
+
+static struct device_attribute resident_pages_attr = {
+	.attr.name	= "resident_pages",
+	.attr.mode	= S_IRUGO,
+	.show		= show_resident_pages,
+};
+
+static ssize_t show_numa_node(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", dev_to_node(dev));
+}
 
-	/* device attributes */
-	err = device_create_file(&d->ldd.dev, &major_attr);
+/* pin the device on the node, or -1 for the first writer's node */
+static ssize_t store_numa_node(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct scullpm_device *d = to_scullpm_device(dev);
+	int node;
+	int err;
+
+	err = kstrtoint(buf, 10, &node);
 	if (err)
-		goto unregister;
-	err = device_create_file(&d->ldd.dev, &minor_attr);
-	if (err) {
-		device_remove_file(&d->ldd.dev, &major_attr);
-		goto unregister;
+		return err;
+	if (node != NUMA_NO_NODE &&
+	    (node < 0 || node >= nr_node_ids || !node_online(node)))
+		return -EINVAL;
+
+	/* same as the order, only for the empty device */
+	mutex_lock(&d->lock);
+	err = -EBUSY;
+	if (!d->nr_pages) {
+		d->node = node;
+		set_dev_node(dev, node);
+		err = 0;
 	}
+	mutex_unlock(&d->lock);
+	return err ? err : count;
+}
+
+static struct device_attribute numa_node_attr = {
+	.attr.name	= "numa_node",
+	.attr.mode	= S_IRUGO|S_IWUSR,
+	.show		= show_numa_node,
+	.store		= store_numa_node,
+};
+
+/* created along with the device */
+static struct attribute *scullpm_attrs[] = {
+	&major_attr.attr,
+	&minor_attr.attr,
+	&page_order_attr.attr,
+	&resident_pages_attr.attr,
+	&numa_node_attr.attr,
+	NULL, /* sentinel */
+};
+ATTRIBUTE_GROUPS(scullpm);
+
+/* before the ldd device registration */
+static void init_device(struct scullpm_device *d, dev_t devt)
+{
+	/* pages are allocated on the first write or fault */
+	init_rwsem(&d->sem);
+	mutex_init(&d->lock);
+	INIT_RADIX_TREE(&d->pages, GFP_KERNEL);
+	d->order = page_order;
+	if (d->order < 0 || d->order >= MAX_ORDER)
+		d->order = SCULLPM_DEFAULT_ORDER;
+	d->node = numa_node;
+	if (d->node < 0 || d->node >= nr_node_ids || !node_online(d->node))
+		d->node = NUMA_NO_NODE;
+
+	/* for /dev/scullpmX */
+	d->ldd.dev.devt = devt;
+	d->ldd.dev.groups = scullpm_groups;
+}
+
+/* after the ldd device registration */
+static int register_device(struct scullpm_device *d)
+{
+	int err;
+
+	set_dev_node(&d->ldd.dev, d->node);
+	err = register_ldd_stats(&d->stats, ldd_dev_name(&d->ldd));
+	if (err)
+		return err;
 
 	/* register in the char dev subsystem */
 	cdev_init(&d->cdev, &fops);
-	err = cdev_add(&d->cdev, devt, 1);
+	err = cdev_add(&d->cdev, d->ldd.dev.devt, 1);
 	if (err)
-		goto remove_attribute;
-
-	mutex_init(&d->lock);
+		goto unregister_stats;
 	return 0;
-remove_attribute:
-	device_remove_file(&d->ldd.dev, &major_attr);
-	device_remove_file(&d->ldd.dev, &minor_attr);
-unregister:
-	unregister_ldd_device(&d->ldd);
+unregister_stats:
+	unregister_ldd_stats(&d->stats);
 	return err;
 }
 
 static void unregister_device(struct scullpm_device *d)
 {
 	cdev_del(&d->cdev);
-	device_remove_file(&d->ldd.dev, &major_attr);
-	device_remove_file(&d->ldd.dev, &minor_attr);
-	unregister_ldd_device(&d->ldd);
+	trim_blocks(d, NULL);
+	unregister_ldd_stats(&d->stats);
 }
 
 static int register_driver(struct scullpm_driver *drv)
@@ -173,9 +558,17 @@ static int __init init(void)
 	if (err)
 		return err;
 
-	for (i = 0, d = devices; d->ldd.name; i++, d++) {
-		err = register_device(d, MKDEV(MAJOR(drv->devt),
-					       MINOR(drv->devt)+i));
+	for (i = 0, d = devices; d->ldd.name; i++, d++)
+		init_device(d, MKDEV(MAJOR(drv->devt), MINOR(drv->devt)+i));
+
+	/* in bulk, bound to scullpm directly */
+	err = register_ldd_devices(&drv->ldd, &devices[0].ldd, NR_SCULLPM_DEV,
+				   sizeof(devices[0]));
+	if (err)
+		goto unregister_driver;
+
+	for (d = devices; d->ldd.name; d++) {
+		err = register_device(d);
 		if (err)
 			goto unregister;
 	}
@@ -183,6 +576,9 @@ static int __init init(void)
 unregister:
 	for (del = devices; del != d; del++)
 		unregister_device(del);
+	unregister_ldd_devices(&devices[0].ldd, NR_SCULLPM_DEV,
+			       sizeof(devices[0]));
+unregister_driver:
 	unregister_driver(drv);
 	return err;
 }
@@ -196,6 +592,8 @@ static void __exit cleanup(void)
 	pr_info("%s\n", __FUNCTION__);
 	for (d = devices; d->ldd.name; d++)
 		unregister_device(d);
+	unregister_ldd_devices(&devices[0].ldd, NR_SCULLPM_DEV,
+			       sizeof(devices[0]));
 	unregister_driver(drv);
 }
 module_exit(cleanup);
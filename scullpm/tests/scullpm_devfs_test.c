@@ -1,9 +1,13 @@
 /* SPDX-License-Identifier: GPL-2.0 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
+#include <setjmp.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -50,6 +54,356 @@ fail:
 	return fail;
 }
 
+static int write_sysfs(const char *filename, const char *val)
+{
+	int ret;
+	int fd;
+
+	fd = open(filename, O_WRONLY);
+	if (fd == -1)
+		return -1;
+	ret = write(fd, val, strlen(val));
+	close(fd);
+	return ret == strlen(val) ? 0 : -1;
+}
+
+static long read_sysfs(const char *filename)
+{
+	char buf[BUFSIZ];
+	int ret;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	ret = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+	return strtol(buf, NULL, 10);
+}
+
+/* write(2), read(2) and mmap(2) on each page order */
+static int test_pages(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*devname;
+		const char	*order_name;
+		const char	*pages_name;
+		const char	*order;
+		size_t		len;
+	} tests[] = {
+		{
+			.name		= "/dev/scullpm0 1024 bytes on order 0",
+			.devname	= "/dev/scullpm0",
+			.order_name	= "/sys/bus/ldd/devices/scullpm0/page_order",
+			.pages_name	= "/sys/bus/ldd/devices/scullpm0/resident_pages",
+			.order		= "0",
+			.len		= 1024,
+		},
+		{
+			.name		= "/dev/scullpm0 65536 bytes on order 0",
+			.devname	= "/dev/scullpm0",
+			.order_name	= "/sys/bus/ldd/devices/scullpm0/page_order",
+			.pages_name	= "/sys/bus/ldd/devices/scullpm0/resident_pages",
+			.order		= "0",
+			.len		= 65536,
+		},
+		{
+			.name		= "/dev/scullpm1 4096 bytes on order 2",
+			.devname	= "/dev/scullpm1",
+			.order_name	= "/sys/bus/ldd/devices/scullpm1/page_order",
+			.pages_name	= "/sys/bus/ldd/devices/scullpm1/resident_pages",
+			.order		= "2",
+			.len		= 4096,
+		},
+		{
+			.name		= "/dev/scullpm1 1048576 bytes on order 2",
+			.devname	= "/dev/scullpm1",
+			.order_name	= "/sys/bus/ldd/devices/scullpm1/page_order",
+			.pages_name	= "/sys/bus/ldd/devices/scullpm1/resident_pages",
+			.order		= "2",
+			.len		= 1048576,
+		},
+		{ /* sentinel */ },
+	};
+	long page_size = sysconf(_SC_PAGESIZE);
+	const struct test *t;
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		long block = page_size << atoi(t->order);
+		char *buf = NULL, *map;
+		long pages, want;
+		size_t total;
+		int ret;
+		int fd;
+		int j;
+
+		printf("%3d) %-12s: %-55s", ++(*i), __FUNCTION__, t->name);
+
+		/* trim it first, as the order only changes on the empty device */
+		fd = open(t->devname, O_WRONLY|O_TRUNC);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		if (write_sysfs(t->order_name, t->order)) {
+			printf("FAIL: write(%s): %s\n", t->order_name,
+			       strerror(errno));
+			goto fail_close;
+		}
+		buf = malloc(t->len);
+		memset(buf, 'w', t->len);
+		for (total = 0; total < t->len; total += ret) {
+			ret = write(fd, buf+total, t->len-total);
+			if (ret <= 0) {
+				printf("FAIL: write(%ld): %s\n", t->len,
+				       strerror(errno));
+				goto fail_close;
+			}
+		}
+		close(fd);
+
+		/* the pages resident, in the page order granularity */
+		want = (t->len+block-1)/block * (block/page_size);
+		pages = read_sysfs(t->pages_name);
+		if (pages != want) {
+			printf("FAIL: %ld=resident_pages, want %ld\n", pages, want);
+			goto fail;
+		}
+
+		/* check and update through the mapping */
+		fd = open(t->devname, O_RDWR);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		map = mmap(NULL, t->len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			printf("FAIL: mmap(%s): %s\n", t->devname, strerror(errno));
+			goto fail_close;
+		}
+		for (j = 0; j < t->len; j++)
+			if (map[j] != 'w') {
+				printf("FAIL: '%c'(map[%d])!='%c'\n", map[j], j, 'w');
+				munmap(map, t->len);
+				goto fail_close;
+			}
+		memset(map, 'm', t->len);
+		munmap(map, t->len);
+
+		/* read(2) should see the update */
+		memset(buf, 'r', t->len);
+		for (total = 0; total < t->len; total += ret) {
+			ret = read(fd, buf+total, t->len-total);
+			if (ret <= 0) {
+				printf("FAIL: read(%ld): %s\n", t->len,
+				       strerror(errno));
+				goto fail_close;
+			}
+		}
+		for (j = 0; j < t->len; j++)
+			if (buf[j] != 'm') {
+				printf("FAIL: '%c'(buf[%d])!='%c'\n", buf[j], j, 'm');
+				goto fail_close;
+			}
+		close(fd);
+
+		/* back to the default order */
+		fd = open(t->devname, O_WRONLY|O_TRUNC);
+		if (fd != -1)
+			close(fd);
+		write_sysfs(t->order_name, "0");
+		free(buf);
+		puts("PASS");
+		ksft_inc_pass_cnt();
+		continue;
+fail_close:
+		close(fd);
+fail:
+		if (buf)
+			free(buf);
+		ksft_inc_fail_cnt();
+		fail++;
+	}
+	return fail;
+}
+
+static sigjmp_buf sigbus_env;
+
+static void sigbus(int signo)
+{
+	siglongjmp(sigbus_env, 1);
+}
+
+/* the device size through the mapping, seen by lseek(2) */
+static int test_mmap_size(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*devname;
+		int		write;	/* through the mapping, or read */
+		off_t		offset;
+		int		want_sigbus;
+		off_t		want;	/* device size after the access */
+	} tests[] = {
+		{
+			.name		= "/dev/scullpm1 read beyond the size",
+			.devname	= "/dev/scullpm1",
+			.offset		= 0,
+			.want_sigbus	= 1,
+			.want		= 0,
+		},
+		{
+			.name		= "/dev/scullpm1 write extends the size",
+			.devname	= "/dev/scullpm1",
+			.write		= 1,
+			.offset		= 4096,
+			.want		= 8192,
+		},
+		{ /* sentinel */ },
+	};
+	struct sigaction sa = { .sa_handler = sigbus }, old;
+	const struct test *t;
+	int fail = 0;
+
+	sigaction(SIGBUS, &sa, &old);
+	for (t = tests; t->name; t++) {
+		volatile char *map = MAP_FAILED;
+		volatile int got_sigbus = 0;
+		off_t size;
+		int fd;
+
+		printf("%3d) %-12s: %-55s", ++(*i), __FUNCTION__, t->name);
+
+		/* start with the empty device */
+		fd = open(t->devname, O_WRONLY|O_TRUNC);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		close(fd);
+		fd = open(t->devname, O_RDWR);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		map = mmap(NULL, t->offset+4096, PROT_READ|PROT_WRITE,
+			   MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			printf("FAIL: mmap(%s): %s\n", t->devname, strerror(errno));
+			goto fail_close;
+		}
+		if (!sigsetjmp(sigbus_env, 1)) {
+			if (t->write)
+				map[t->offset] = 'm';
+			else
+				(void)map[t->offset];
+		} else
+			got_sigbus = 1;
+		munmap((void *)map, t->offset+4096);
+		if (got_sigbus != t->want_sigbus) {
+			printf("FAIL: SIGBUS=%d\n", got_sigbus);
+			goto fail_close;
+		}
+		size = lseek(fd, 0, SEEK_END);
+		if (size != t->want) {
+			printf("FAIL: %ld=size, want %ld\n", (long)size,
+			       (long)t->want);
+			goto fail_close;
+		}
+		close(fd);
+		puts("PASS");
+		ksft_inc_pass_cnt();
+		continue;
+fail_close:
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		fail++;
+	}
+	sigaction(SIGBUS, &old, NULL);
+	return fail;
+}
+
+/* pinned node, or the first writer's node with -1 */
+static int test_numa(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*devname;
+		const char	*node_name;
+		const char	*node;
+		long		want;	/* -1 for any online node */
+	} tests[] = {
+		{
+			.name		= "/dev/scullpm0 pinned on node 0",
+			.devname	= "/dev/scullpm0",
+			.node_name	= "/sys/bus/ldd/devices/scullpm0/numa_node",
+			.node		= "0",
+			.want		= 0,
+		},
+		{
+			.name		= "/dev/scullpm0 on the first writer's node",
+			.devname	= "/dev/scullpm0",
+			.node_name	= "/sys/bus/ldd/devices/scullpm0/numa_node",
+			.node		= "-1",
+			.want		= -1,
+		},
+		{ /* sentinel */ },
+	};
+	const struct test *t;
+	int fail = 0;
+
+	for (t = tests; t->name; t++) {
+		long node;
+		int fd;
+
+		printf("%3d) %-12s: %-55s", ++(*i), __FUNCTION__, t->name);
+
+		fd = open(t->devname, O_WRONLY|O_TRUNC);
+		if (fd == -1) {
+			printf("FAIL: open(%s): %s\n", t->devname, strerror(errno));
+			goto fail;
+		}
+		if (write_sysfs(t->node_name, t->node)) {
+			printf("FAIL: write(%s): %s\n", t->node_name,
+			       strerror(errno));
+			goto fail_close;
+		}
+		if (write(fd, "w", 1) != 1) {
+			printf("FAIL: write(1): %s\n", strerror(errno));
+			goto fail_close;
+		}
+		close(fd);
+
+		/* the node is fixed by the first write */
+		node = read_sysfs(t->node_name);
+		if (t->want == -1 ? node < 0 : node != t->want) {
+			printf("FAIL: %ld=numa_node, want %ld\n", node, t->want);
+			goto fail;
+		}
+
+		/* back to the first writer's node */
+		fd = open(t->devname, O_WRONLY|O_TRUNC);
+		if (fd != -1)
+			close(fd);
+		write_sysfs(t->node_name, "-1");
+		puts("PASS");
+		ksft_inc_pass_cnt();
+		continue;
+fail_close:
+		close(fd);
+fail:
+		ksft_inc_fail_cnt();
+		fail++;
+	}
+	return fail;
+}
+
 int main(void)
 {
 	int fail = 0;
@@ -57,6 +411,12 @@ int main(void)
 
 	if (test_devfs(&i))
 		fail++;
+	if (test_pages(&i))
+		fail++;
+	if (test_mmap_size(&i))
+		fail++;
+	if (test_numa(&i))
+		fail++;
 
 	if (fail)
 		ksft_exit_fail();
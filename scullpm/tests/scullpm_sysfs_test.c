@@ -23,7 +23,7 @@ static int test_sysfs(int *i)
 		{
 			.name		= "/sys/bus/ldd/drivers/scullpm/version drvier version",
 			.filename	= "/sys/bus/ldd/drivers/scullpm/version",
-			.want		= "1.0.0",
+			.want		= "1.4.0",
 		},
 		{
 			.name		= "/sys/bus/ldd/drivers/scullpm/scullpm0/uevent file",
@@ -35,6 +35,21 @@ static int test_sysfs(int *i)
 			.filename	= "/sys/bus/ldd/drivers/scullpm/scullpm1/uevent",
 			.want		= "DRIVER=scullpm",
 		},
+		{
+			.name		= "/sys/bus/ldd/drivers/scullpm/scullpm0/page_order file",
+			.filename	= "/sys/bus/ldd/drivers/scullpm/scullpm0/page_order",
+			.want		= "0",
+		},
+		{
+			.name		= "/sys/bus/ldd/drivers/scullpm/scullpm1/page_order file",
+			.filename	= "/sys/bus/ldd/drivers/scullpm/scullpm1/page_order",
+			.want		= "0",
+		},
+		{
+			.name		= "/sys/bus/ldd/drivers/scullpm/scullpm0/numa_node file",
+			.filename	= "/sys/bus/ldd/drivers/scullpm/scullpm0/numa_node",
+			.want		= "-1",
+		},
 		{ /* sentinel */ },
 	};
 	const struct test *t;
@@ -7,49 +7,62 @@
 #include <linux/device.h>
 #include <linux/cdev.h>
 #include <linux/fs.h>
-#include <linux/mutex.h>
+#include <linux/atomic.h>
 #include <linux/sched.h>
 #include <linux/wait.h>
+#include <linux/sysfs.h>
+
+#include "../ldd/ldd.h"
+#include "../ldd/trace.h"
 
 #define NR_SLEEPY_DEV		4
 #define SLEEPY_DEV_PREFIX	"sleep"
-#define SLEEPY_DEV_NAME_LEN	(strlen(SLEEPY_DEV_PREFIX) + 2)
-
-/* sleepy device descriptor */
+#define SLEEPY_DEV_NAME_LEN	(sizeof(SLEEPY_DEV_PREFIX) + 1)
+
+/*
+ * sleepy device descriptor.
+ *
+ * Each byte written is a token releasing exactly one reader, in the
+ * default wake one mode, so that the writes arriving before the
+ * readers are never lost.  In the wake all mode, the write releases
+ * all the readers sleeping at the time, instead.  Both are lock free
+ * for the readers.
+ */
 static struct sleepy {
 	struct device		dev;
 	struct cdev		cdev;
 	wait_queue_head_t	wq;
-	struct mutex		lock;
-	int			ready;
+	atomic_long_t		tokens;	/* pending wake ups, wake one mode */
+	atomic_t		seq;	/* broadcast sequence, wake all mode */
+	bool			wake_all;
+	struct ldd_stats	stats;
+	char			name[SLEEPY_DEV_NAME_LEN];	/* init_name */
 } sleepys[NR_SLEEPY_DEV];
 
-static inline void ready(struct sleepy *s)
+/* release the readers, the batch of nr ones with a single wake up */
+static void ready(struct sleepy *s, int nr)
 {
-	mutex_lock_interruptible(&s->lock);
-	s->ready = 1;
-	mutex_unlock(&s->lock);
+	if (READ_ONCE(s->wake_all)) {
+		atomic_inc(&s->seq);
+		wake_up_interruptible_all(&s->wq);
+	} else {
+		atomic_long_add(nr, &s->tokens);
+		wake_up_interruptible_nr(&s->wq, nr);
+	}
 }
 
-static int is_ready(struct sleepy *s)
+/* take the token, or catch the broadcast since seq */
+static bool is_ready(struct sleepy *s, int seq)
 {
-	int ready;
-	int err;
-
-	err = mutex_lock_interruptible(&s->lock);
-	if (err)
-		return 0;
-	ready = s->ready;
-	s->ready = 0; /* only one waiter to wake up */
-	mutex_unlock(&s->lock);
-	return ready;
+	return atomic_long_add_unless(&s->tokens, -1, 0) ||
+		atomic_read(&s->seq) != seq;
 }
 
 /* file operation methods */
 static int sleepy_open(struct inode *i, struct file *f)
 {
 	struct sleepy *s = container_of(i->i_cdev, struct sleepy, cdev);
-	pr_info("%s(%s)\n", __FUNCTION__, dev_name(&s->dev));
+	trace_ldd_op(dev_name(&s->dev), "open", 0, 0);
 	f->private_data = s; /* for other methods */
 	return 0;
 }
@@ -57,30 +70,35 @@ static int sleepy_open(struct inode *i, struct file *f)
 static ssize_t sleepy_read(struct file *f, char __user *buf, size_t len, loff_t *pos)
 {
 	struct sleepy *s = f->private_data;
+	int seq = atomic_read(&s->seq);
+	u64 start;
+	int err;
 
-	pr_info("%s(%s)\n", __FUNCTION__, dev_name(&s->dev));
-	pr_info("process %i (%s) going to sleep\n",
-		current->pid, current->comm);
-	wait_event_interruptible(s->wq, is_ready(s));
-	pr_info("awoken %i (%s)\n", current->pid, current->comm);
+	/* exclusive, for wake_up_interruptible_nr() to release nr readers */
+	start = ldd_stats_start();
+	err = wait_event_interruptible_exclusive(s->wq, is_ready(s, seq));
+	ldd_stats_end(&s->stats, LDD_LAT_SLEEP, start);
+	trace_ldd_op(dev_name(&s->dev), "read", len, err);
 	return 0; /* EOF */
 }
 
+/*
+ * one token per byte, whatever the bytes are, e.g. "hello\n" releases
+ * six readers, the newline included.
+ */
 static ssize_t sleepy_write(struct file *f, const char __user *buf, size_t len, loff_t *pos)
 {
 	struct sleepy *s = f->private_data;
-	pr_info("%s(%s)\n", __FUNCTION__, dev_name(&s->dev));
-	pr_info("process %i (%s) awakening the reader...\n",
-		current->pid, current->comm);
-	ready(s);
-	wake_up_interruptible(&s->wq);
+	trace_ldd_op(dev_name(&s->dev), "write", len, len);
+	if (len)
+		ready(s, len); /* len is below MAX_RW_COUNT */
 	return len; /* avoid retry */
 }
 
 static int sleepy_release(struct inode *i, struct file *f)
 {
 	struct sleepy *s = f->private_data;
-	pr_info("%s(%s)\n", __FUNCTION__, dev_name(&s->dev));
+	trace_ldd_op(dev_name(&s->dev), "release", 0, 0);
 	/* just to be inline with sleepy_open() */
 	f->private_data = NULL;
 	return 0;
@@ -93,18 +111,48 @@ static const struct file_operations sleepy_ops = {
 	.release = sleepy_release,
 };
 
-static void __init sleepy_initialize(struct sleepy *s, const dev_t dev_base, int i)
+static ssize_t show_wake(struct device *dev, struct device_attribute *attr,
+			 char *buf)
 {
-	char name[SLEEPY_DEV_NAME_LEN];
+	struct sleepy *s = container_of(dev, struct sleepy, dev);
+	return snprintf(buf, PAGE_SIZE, "%s\n",
+			READ_ONCE(s->wake_all) ? "all" : "one");
+}
 
+static ssize_t store_wake(struct device *dev, struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	struct sleepy *s = container_of(dev, struct sleepy, dev);
+
+	if (sysfs_streq(buf, "one"))
+		WRITE_ONCE(s->wake_all, false);
+	else if (sysfs_streq(buf, "all"))
+		WRITE_ONCE(s->wake_all, true);
+	else
+		return -EINVAL;
+	return count;
+}
+
+static DEVICE_ATTR(wake, S_IRUGO|S_IWUSR, show_wake, store_wake);
+
+static struct attribute *sleepy_attrs[] = {
+	&dev_attr_wake.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(sleepy);
+
+static void __init sleepy_initialize(struct sleepy *s, const dev_t dev_base, int i)
+{
 	device_initialize(&s->dev);
 	s->dev.devt = MKDEV(MAJOR(dev_base), MINOR(dev_base) + i);
-	sprintf(name, SLEEPY_DEV_PREFIX "%d", i);
-	s->dev.init_name = name;
+	snprintf(s->name, sizeof(s->name), SLEEPY_DEV_PREFIX "%d", i);
+	s->dev.init_name = s->name;
+	s->dev.groups = sleepy_groups;
 	cdev_init(&s->cdev, &sleepy_ops);
 	s->cdev.owner = THIS_MODULE;
-	s->ready = 0;
-	mutex_init(&s->lock);
+	atomic_long_set(&s->tokens, 0);
+	atomic_set(&s->seq, 0);
+	s->wake_all = false;
 	init_waitqueue_head(&s->wq);
 }
 
@@ -127,10 +175,17 @@ static int __init sleepy_init(void)
 	for (s = sleepys, i = 0; i < nr_dev; s++, i++) {
 		sleepy_initialize(s, dev_base, i);
 
+		/* latency histograms, before the device node shows up */
+		err = register_ldd_stats(&s->stats, dev_name(&s->dev));
+		if (err)
+			goto unregister;
+
 		/* add cdev into the character device subsystem */
 		err = cdev_device_add(&s->cdev, &s->dev);
-		if (err)
+		if (err) {
+			unregister_ldd_stats(&s->stats);
 			goto unregister;
+		}
 
 		pr_info("%s[%d:%d]: added\n", dev_name(&s->dev),
 			MAJOR(s->dev.devt), MINOR(s->dev.devt));
@@ -140,6 +195,7 @@ unregister:
 	/* only delete already added devices */
 	for (s = sleepys, j = 0; j < i; s++, j++) {
 		cdev_device_del(&s->cdev, &s->dev);
+		unregister_ldd_stats(&s->stats);
 		pr_info("%s[%d:%d]: deleted\n", dev_name(&s->dev),
 			MAJOR(s->dev.devt), MINOR(s->dev.devt));
 	}
@@ -159,6 +215,7 @@ static void __exit sleepy_exit(void)
 
 	for (s = sleepys, i = 0; i < nr_dev; s++, i++) {
 		cdev_device_del(&s->cdev, &s->dev);
+		unregister_ldd_stats(&s->stats);
 		pr_info("%s[%d:%d]: deleted\n", dev_name(&s->dev),
 			MAJOR(s->dev.devt), MINOR(s->dev.devt));
 	}
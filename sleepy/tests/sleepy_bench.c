@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define BENCH_NAME	"sleepy_bench"
+#define MAX_READERS	8
+#define MAX_ITERATIONS	1000
+
+/* shared by the writer and the readers of the case */
+struct bench {
+	const char		*file_name;
+	int			readers;
+	int			iterations;
+	unsigned long long	t0;	/* of the write(2), per iteration */
+	int			ready;	/* readers about to sleep, cumulative */
+	int			done;	/* readers woken up, cumulative */
+	unsigned long long	*lat;	/* iterations*readers, in nsec */
+};
+
+static struct utsname uts;
+
+/* tab separated kernel release, benchmark, case, metric and value */
+static void report(const char *name, const char *metric, double value)
+{
+	printf("%s\t%s\t%s\t%s\t%.3f\n", uts.release, BENCH_NAME, name,
+	       metric, value);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int set_wake(const char *sysfs_name, const char *mode)
+{
+	int ret;
+	int fd;
+
+	fd = open(sysfs_name, O_WRONLY);
+	if (fd == -1)
+		return -1;
+	ret = write(fd, mode, strlen(mode));
+	close(fd);
+	return ret == strlen(mode) ? 0 : -1;
+}
+
+/* wait for the cumulative counter to reach want */
+static void wait_for(int *counter, int want)
+{
+	while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < want)
+		sched_yield();
+}
+
+static void *reader(void *arg)
+{
+	struct bench *b = arg;
+	char buf[1];
+	int j, fd;
+	int idx;
+
+	fd = open(b->file_name, O_RDONLY);
+	if (fd == -1)
+		return (void *)-1;
+	for (j = 0; j < b->iterations; j++) {
+		idx = __atomic_fetch_add(&b->ready, 1, __ATOMIC_RELEASE);
+		if (read(fd, buf, sizeof(buf)) == -1) {
+			close(fd);
+			return (void *)-1;
+		}
+		b->lat[idx] = now_ns() - __atomic_load_n(&b->t0, __ATOMIC_ACQUIRE);
+		__atomic_fetch_add(&b->done, 1, __ATOMIC_RELEASE);
+
+		/* not to steal the token of the slower readers */
+		wait_for(&b->done, (j+1)*b->readers);
+	}
+	close(fd);
+	return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int wake_latency_bench(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*file_name;
+		const char	*sysfs_name;
+		const char	*mode;
+		int		readers;
+	} tests[] = {
+		{
+			.name		= "wake-one-1reader",
+			.file_name	= "/dev/sleep0",
+			.sysfs_name	= "/sys/devices/sleep0/wake",
+			.mode		= "one",
+			.readers	= 1,
+		},
+		{
+			.name		= "wake-one-4readers",
+			.file_name	= "/dev/sleep1",
+			.sysfs_name	= "/sys/devices/sleep1/wake",
+			.mode		= "one",
+			.readers	= 4,
+		},
+		{
+			.name		= "wake-all-4readers",
+			.file_name	= "/dev/sleep2",
+			.sysfs_name	= "/sys/devices/sleep2/wake",
+			.mode		= "all",
+			.readers	= 4,
+		},
+		{ /* sentry */ },
+	};
+	static unsigned long long lat[MAX_ITERATIONS*MAX_READERS];
+	const struct test *t;
+	char buf[MAX_READERS];
+	int fail = 0;
+
+	memset(buf, 'w', sizeof(buf));
+	for (t = tests; t->name; t++) {
+		pthread_t readers[MAX_READERS];
+		struct bench b = {
+			.file_name	= t->file_name,
+			.readers	= t->readers,
+			.iterations	= MAX_ITERATIONS,
+			.lat		= lat,
+		};
+		/* one token per reader, or a single broadcast */
+		int len = strcmp(t->mode, "all") ? t->readers : 1;
+		int nr = b.iterations*b.readers;
+		double sum = 0;
+		void *ret;
+		int err = 0;
+		int fd;
+		int j;
+
+		fprintf(stderr, "%2d) %-70s", (*i)++, t->name);
+
+		if (set_wake(t->sysfs_name, t->mode)) {
+			perror("set_wake");
+			goto fail;
+		}
+		fd = open(t->file_name, O_WRONLY);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+		for (j = 0; j < t->readers; j++)
+			pthread_create(&readers[j], NULL, reader, &b);
+		for (j = 0; j < b.iterations; j++) {
+			wait_for(&b.ready, (j+1)*b.readers);
+			usleep(1000); /* let them sleep */
+			__atomic_store_n(&b.t0, now_ns(), __ATOMIC_RELEASE);
+			if (write(fd, buf, len) != len) {
+				perror("write");
+				err = -1;
+				break;
+			}
+			wait_for(&b.done, (j+1)*b.readers);
+		}
+		if (err) {
+			/* release the rest of the readers */
+			set_wake(t->sysfs_name, "one");
+			for (j = 0; j < t->readers; j++)
+				pthread_cancel(readers[j]);
+		}
+		for (j = 0; j < t->readers; j++) {
+			pthread_join(readers[j], &ret);
+			if (ret && ret != PTHREAD_CANCELED)
+				err = -1;
+		}
+		close(fd);
+		set_wake(t->sysfs_name, "one");
+		if (err)
+			goto fail;
+
+		qsort(lat, nr, sizeof(lat[0]), compare);
+		for (j = 0; j < nr; j++)
+			sum += lat[j];
+		report(t->name, "mean-usec", sum/nr/1e3);
+		report(t->name, "p50-usec", lat[nr/2]/1e3);
+		report(t->name, "p99-usec", lat[nr*99/100]/1e3);
+		report(t->name, "max-usec", lat[nr-1]/1e3);
+		fprintf(stderr, "%10.1fusec\n", lat[nr/2]/1e3);
+		continue;
+fail:
+		fprintf(stderr, "FAIL\n");
+		fail++;
+	}
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	uname(&uts);
+
+	if (wake_latency_bench(&i))
+		fail++;
+
+	return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
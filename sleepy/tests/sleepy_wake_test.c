@@ -0,0 +1,211 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kselftest.h"
+
+#define MAX_READERS	8
+
+static int set_wake(const char *sysfs_name, const char *mode)
+{
+	int ret;
+	int fd;
+
+	fd = open(sysfs_name, O_WRONLY);
+	if (fd == -1)
+		return -1;
+	ret = write(fd, mode, strlen(mode));
+	close(fd);
+	return ret == strlen(mode) ? 0 : -1;
+}
+
+/* reader blocked in read(2), to be released by the writer */
+static pid_t reader(const char *file_name)
+{
+	char buf[1];
+	pid_t pid;
+	int fd;
+
+	pid = fork();
+	if (pid)
+		return pid;
+	fd = open(file_name, O_RDONLY);
+	if (fd == -1)
+		_exit(1);
+	if (read(fd, buf, sizeof(buf)) == -1)
+		_exit(1);
+	close(fd);
+	_exit(0);
+}
+
+/* reap the released readers, within 100ms */
+static int reap(pid_t *pids, int nr)
+{
+	int released = 0;
+	int i, j;
+
+	for (i = 0; i < 10; i++) {
+		for (j = 0; j < nr; j++) {
+			int status;
+
+			if (pids[j] <= 0)
+				continue;
+			if (waitpid(pids[j], &status, WNOHANG) != pids[j])
+				continue;
+			pids[j] = 0;
+			released++;
+		}
+		usleep(10000);
+	}
+	return released;
+}
+
+static int wake_test(int *i)
+{
+	const struct test {
+		const char	*name;
+		const char	*file_name;
+		const char	*sysfs_name;
+		const char	*mode;
+		int		readers;
+		int		before;	/* bytes written before the readers */
+		int		after;	/* bytes written after the readers */
+		const char	*data;	/* written instead of the 'w's */
+		int		want;
+	} tests[] = {
+		{
+			.name		= "wake one: 1 byte releases 1 of 4 readers",
+			.file_name	= "/dev/sleep0",
+			.sysfs_name	= "/sys/devices/sleep0/wake",
+			.mode		= "one",
+			.readers	= 4,
+			.after		= 1,
+			.want		= 1,
+		},
+		{
+			.name		= "wake one: 3 bytes release 3 of 4 readers",
+			.file_name	= "/dev/sleep1",
+			.sysfs_name	= "/sys/devices/sleep1/wake",
+			.mode		= "one",
+			.readers	= 4,
+			.after		= 3,
+			.want		= 3,
+		},
+		{
+			.name		= "wake one: 2 bytes before 4 readers release 2",
+			.file_name	= "/dev/sleep2",
+			.sysfs_name	= "/sys/devices/sleep2/wake",
+			.mode		= "one",
+			.readers	= 4,
+			.before		= 2,
+			.want		= 2,
+		},
+		{
+			.name		= "wake one: \"hello\\n\" releases 6 of 8 readers",
+			.file_name	= "/dev/sleep1",
+			.sysfs_name	= "/sys/devices/sleep1/wake",
+			.mode		= "one",
+			.readers	= 8,
+			.data		= "hello\n",
+			.after		= 6,
+			.want		= 6,
+		},
+		{
+			.name		= "wake all: 1 byte releases all 4 readers",
+			.file_name	= "/dev/sleep3",
+			.sysfs_name	= "/sys/devices/sleep3/wake",
+			.mode		= "all",
+			.readers	= 4,
+			.after		= 1,
+			.want		= 4,
+		},
+		{ /* sentry */ },
+	};
+	const struct test *t;
+	char buf[MAX_READERS];
+	int fail = 0;
+
+	memset(buf, 'w', sizeof(buf));
+	for (t = tests; t->name; t++) {
+		pid_t pids[MAX_READERS];
+		int released;
+		int fd = -1;
+		int j;
+
+		printf("%2d) %-70s", (*i)++, t->name);
+
+		memset(pids, 0, sizeof(pids));
+		if (set_wake(t->sysfs_name, t->mode)) {
+			perror("set_wake");
+			goto fail;
+		}
+		fd = open(t->file_name, O_WRONLY);
+		if (fd == -1) {
+			perror("open");
+			goto fail;
+		}
+		if (t->before && write(fd, buf, t->before) != t->before) {
+			perror("write");
+			goto fail;
+		}
+		for (j = 0; j < t->readers; j++)
+			pids[j] = reader(t->file_name);
+		usleep(100000); /* let them sleep */
+		if (t->after && write(fd, t->data ? t->data : buf, t->after) !=
+		    t->after) {
+			perror("write");
+			goto fail;
+		}
+		released = reap(pids, t->readers);
+		if (released != t->want) {
+			printf("%d released readers\n", released);
+			goto fail;
+		}
+
+		/* release the rest */
+		set_wake(t->sysfs_name, "one");
+		write(fd, buf, t->readers-released);
+		reap(pids, t->readers);
+		close(fd);
+		ksft_inc_pass_cnt();
+		puts("PASS");
+		continue;
+fail:
+		for (j = 0; j < t->readers; j++)
+			if (pids[j] > 0) {
+				kill(pids[j], SIGKILL);
+				waitpid(pids[j], NULL, 0);
+			}
+		if (fd != -1)
+			close(fd);
+		set_wake(t->sysfs_name, "one");
+		ksft_inc_fail_cnt();
+		puts("FAIL");
+		fail++;
+	}
+	if (fail)
+		return 1;
+	return 0;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	if (wake_test(&i))
+		fail++;
+
+	puts("");
+	if (fail)
+		ksft_exit_fail();
+	else
+		ksft_exit_pass();
+}
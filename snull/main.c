@@ -6,11 +6,34 @@
 #include <linux/string.h>
 #include <linux/spinlock.h>
 #include <linux/slab.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/ip.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/bpf_trace.h>
+#include <net/xdp.h>
+
+#define CREATE_TRACE_POINTS
+#include "trace.h"
 
 #define SNULL_TX_DEFAULT_TIMEOUT_SEC		10
+#define SNULL_DEFAULT_NAPI_BUDGET		NAPI_POLL_WEIGHT
+#define SNULL_MAX_QUEUES			16
+#define SNULL_MAX_MTU				9000	/* jumbo */
+#define SNULL_POOL_SIZE				32
+#define SNULL_GSO_MAX_SEGS			16
+#define SNULL_HEADROOM				XDP_PACKET_HEADROOM
+#define SNULL_XDP_FRAG_SIZE(len)	\
+	(SKB_DATA_ALIGN(XDP_PACKET_HEADROOM + (len)) + \
+	 SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+#define SNULL_XDP_MAX_MTU		\
+	(PAGE_SIZE - XDP_PACKET_HEADROOM - ETH_HLEN - \
+	 SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+#define SNULL_RX_SKB_QUEUE_LEN			1000
 
 /* device lockup parameters */
 static int tx_lockup = 0;
@@ -18,6 +41,20 @@ static int tx_timeout = SNULL_TX_DEFAULT_TIMEOUT_SEC;
 module_param(tx_lockup, int, S_IRUGO|S_IWUSR);
 module_param(tx_timeout, int, S_IRUGO|S_IWUSR);
 
+/* NAPI based RX, instead of the regular interrupt */
+static bool napi = false;
+static int napi_budget = SNULL_DEFAULT_NAPI_BUDGET;
+module_param(napi, bool, S_IRUGO);
+module_param(napi_budget, int, S_IRUGO);
+
+/* TX/RX queue pairs, 0 for one pair per online CPU */
+static int queues = 0;
+module_param(queues, int, S_IRUGO);
+
+/* hand the TX skb to the peer's RX path, instead of copying it */
+static bool zerocopy = false;
+module_param(zerocopy, bool, S_IRUGO);
+
 /* sn0 and sn1 */
 static struct net_device *netdevs[2];
 
@@ -28,14 +65,33 @@ static struct net_device *dest_dev(const struct net_device *dev)
 
 /* snull packet buffer */
 struct snull_buff {
-	struct snull_buff	*next;
+	struct snull_buff	*next;		/* in the RX queue */
+	struct llist_node	node;		/* in the pool */
 	struct net_device	*dev;
 	int			datalen;
-	u8			data[ETH_DATA_LEN];
+	int			offset;		/* of the frame in the data */
+	int			size;		/* of the frame, by the MTU */
+	u8			data[];		/* headroom for XDP, and frame */
 };
 
-/* snull device */
-struct snull_dev {
+/* per-CPU counters, folded by ndo_get_stats64 */
+struct snull_stats {
+	u64			rx_packets;
+	u64			rx_bytes;
+	u64			rx_dropped;
+	u64			tx_packets;
+	u64			tx_bytes;
+	u64			tx_errors;
+	u64			tx_dropped;
+	struct u64_stats_sync	syncp;
+};
+
+/*
+ * snull TX/RX queue pair.  The TX queue i of a device delivers to
+ * the RX queue i of the peer, and the buffer goes back to the pool
+ * of the pair i of the source, so that the pairs never share a lock.
+ */
+struct snull_queue {
 	spinlock_t		lock;
 	int			status;
 #define SNULL_RX_INTR		(1 << 0)
@@ -43,21 +99,64 @@ struct snull_dev {
 #define SNULL_TX_TIMEOUT	(1 << 2)
 	struct sk_buff		*skb;		/* inflight TX skb */
 	int			datalen;	/* inflight TX data len */
-	struct snull_buff	*pool;
+	struct llist_head	pool;		/* lock-free free list */
+	atomic_t		pool_avail;
 	struct snull_buff	*rx_queue;
+	struct snull_buff	**rx_tail;
+	struct sk_buff_head	rx_skbs;	/* zero-copy RX queue */
+	int			rx_int_enabled;
+	unsigned long		tx_count;	/* for the lockup simulation */
+	u16			index;
+	struct net_device	*dev;
+	struct napi_struct	napi;
+	struct xdp_rxq_info	xdp_rxq;
+	bool			xdp_flush;	/* redirected in the poll */
+} ____cacheline_aligned_in_smp;
+
+/* snull device */
+struct snull_dev {
+	struct snull_stats __percpu *stats;
+	struct bpf_prog __rcu	*xdp_prog;	/* only in the NAPI mode */
 	irqreturn_t (*interrupt)(int, void *, struct pt_regs *);
+	struct snull_queue	queues[];
 };
 
-static inline int snull_tx_lockup(void)
+/* update the local CPU counter, e.g. snull_stats_add(dev, rx_bytes, len) */
+#define snull_stats_add(_dev, _field, _val)				\
+	do {								\
+		struct snull_dev *__s = netdev_priv(_dev);		\
+		struct snull_stats *__st = this_cpu_ptr(__s->stats);	\
+		u64_stats_update_begin(&__st->syncp);			\
+		__st->_field += (_val);					\
+		u64_stats_update_end(&__st->syncp);			\
+	} while (0)
+
+static inline struct snull_queue *snull_queue(struct net_device *dev,
+					      u16 index)
 {
-	int val;
+	struct snull_dev *s = netdev_priv(dev);
 
-	/* lock is required, as in linux/moduleparam.h */
-	kernel_param_lock(THIS_MODULE);
-	val = tx_lockup;
-	kernel_param_unlock(THIS_MODULE);
+	return &s->queues[index];
+}
 
-	return val;
+/* the peer's queue of the same pair */
+static inline struct snull_queue *dest_queue(const struct snull_queue *q)
+{
+	return snull_queue(dest_dev(q->dev), q->index);
+}
+
+static inline struct netdev_queue *snull_txq(const struct snull_queue *q)
+{
+	return netdev_get_tx_queue(q->dev, q->index);
+}
+
+/*
+ * No kernel_param_lock() here, as it's the mutex and this is called
+ * on the TX path.  The int is read atomically, which is good enough.
+ */
+static inline int snull_tx_lockup(void)
+{
+	return READ_ONCE(tx_lockup);
 }
 
 static inline int snull_tx_timeout_tick(void)
@@ -72,134 +171,192 @@ static inline int snull_tx_timeout_tick(void)
 	return val*HZ;
 }
 
-static int init_pool(struct net_device *dev)
+/* the buffer holds the whole frame of the current MTU */
+static int init_pool(struct snull_queue *q)
 {
-	struct snull_dev *s = netdev_priv(dev);
+	int size = ETH_HLEN + q->dev->mtu;
 	struct snull_buff *b;
 	int i;
 
-	s->pool = NULL;
-	for (i = 0; i < 8; i++) {
-		b = kzalloc(sizeof(struct snull_buff), GFP_KERNEL);
+	init_llist_head(&q->pool);
+	atomic_set(&q->pool_avail, 0);
+	for (i = 0; i < SNULL_POOL_SIZE; i++) {
+		b = kzalloc(sizeof(struct snull_buff) + SNULL_HEADROOM + size,
+			    GFP_KERNEL);
 		if (unlikely(!b))
 			return -ENOMEM;
-		b->next = s->pool;
-		s->pool = b;
+		b->size = size;
+		llist_add(&b->node, &q->pool);
+		atomic_inc(&q->pool_avail);
 	}
 	return 0;
 }
 
-static void free_pool(struct net_device *dev)
+static void free_pool(struct snull_queue *q)
 {
-	struct snull_dev *s = netdev_priv(dev);
-	struct snull_buff *b;
+	struct snull_buff *b, *n;
 
-	while ((b = s->pool)) {
-		s->pool = b->next;
+	llist_for_each_entry_safe(b, n, llist_del_all(&q->pool), node)
 		kfree(b);
-	}
 }
 
-static struct snull_buff *dequeue_pool(struct net_device *dev)
+/*
+ * The pool is only consumed by the TX path, which is serialized by
+ * the TX queue lock, while it's filled by the peer's RX path.  That
+ * is the single consumer and the multiple producers of the llist.
+ *
+ * The queue is stopped while the pool can't hold the largest GSO skb,
+ * so that the segments of the skb never run out of the buffer.
+ */
+static struct snull_buff *dequeue_pool(struct snull_queue *q)
 {
-	struct snull_dev *s = netdev_priv(dev);
-	struct snull_buff *b = s->pool;
-	unsigned long flags;
-
-	spin_lock_irqsave(&s->lock, flags);
-	b = s->pool;
-	s->pool = b->next;
-	if (!s->pool)
-		netif_stop_queue(dev); /* no more buffer in the pool */
-	spin_unlock_irqrestore(&s->lock, flags);
-
-	return b;
+	struct llist_node *node;
+
+	node = llist_del_first(&q->pool);
+	if (unlikely(!node))
+		return NULL;
+	if (atomic_dec_return(&q->pool_avail) < SNULL_GSO_MAX_SEGS) {
+		/* not enough buffer in the pool */
+		trace_snull_pool_empty(q->dev, q->index);
+		netif_tx_stop_queue(snull_txq(q));
+		/* paired with atomic_inc_return() in enqueue_pool() */
+		smp_mb__after_atomic();
+		if (atomic_read(&q->pool_avail) >= SNULL_GSO_MAX_SEGS)
+			netif_tx_wake_queue(snull_txq(q));
+	}
+	return llist_entry(node, struct snull_buff, node);
 }
 
-void enqueue_pool(struct net_device *dev, struct snull_buff *b)
+void enqueue_pool(struct snull_queue *q, struct snull_buff *b)
 {
-	struct snull_dev *s = netdev_priv(dev);
-	unsigned long flags;
+	llist_add(&b->node, &q->pool);
 
-	spin_lock_irqsave(&s->lock, flags);
-	b->next = s->pool;
-	s->pool = b;
-	if (netif_queue_stopped(dev) && !b->next)
-		netif_wake_queue(dev);
-	spin_unlock_irqrestore(&s->lock, flags);
+	/* wake up the queue, stopped by the pool exhaustion */
+	if (atomic_inc_return(&q->pool_avail) == SNULL_GSO_MAX_SEGS &&
+	    netif_tx_queue_stopped(snull_txq(q)))
+		netif_tx_wake_queue(snull_txq(q));
 }
 
-static void free_rx(struct net_device *dev)
+static void free_rx(struct snull_queue *q)
 {
-	struct snull_dev *s = netdev_priv(dev);
-	struct snull_buff *b;
+	struct snull_buff *b, *next;
+	struct sk_buff_head skbs;
+	unsigned long flags;
 
-	while ((b = s->rx_queue)) {
-		s->rx_queue = b->next;
+	__skb_queue_head_init(&skbs);
+	spin_lock_irqsave(&q->lock, flags);
+	b = q->rx_queue;
+	q->rx_queue = NULL;
+	q->rx_tail = &q->rx_queue;
+	skb_queue_splice_init(&q->rx_skbs, &skbs);
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	for (; b; b = next) {
+		next = b->next;
 		kfree(b);
 	}
+	__skb_queue_purge(&skbs);
 }
 
-struct snull_buff *dequeue_rx(struct net_device *dev)
+struct snull_buff *dequeue_rx(struct snull_queue *q)
 {
-	struct snull_dev *s = netdev_priv(dev);
 	struct snull_buff *pkt;
 	unsigned long flags;
 
-	spin_lock_irqsave(&s->lock, flags);
-	pkt = s->rx_queue;
-	if (pkt)
-		s->rx_queue = pkt->next;
-	spin_unlock_irqrestore(&s->lock, flags);
+	spin_lock_irqsave(&q->lock, flags);
+	pkt = q->rx_queue;
+	if (pkt) {
+		q->rx_queue = pkt->next;
+		if (!q->rx_queue)
+			q->rx_tail = &q->rx_queue;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
 
 	return pkt;
 }
 
-static void enqueue_rx(struct net_device *dev, struct snull_buff *pkt)
+/* O(1) with the tail pointer, whatever the queue depth is */
+static void enqueue_rx(struct snull_queue *q, struct snull_buff *pkt)
 {
-	struct snull_dev *s = netdev_priv(dev);
-	struct snull_buff **bp;
 	unsigned long flags;
 
 	pkt->next = NULL;
-	spin_lock_irqsave(&s->lock, flags);
-	for (bp = &s->rx_queue; *bp; bp = &(*bp)->next)
-		; /* skip to the tail */
-	*bp = pkt;
-	spin_unlock_irqrestore(&s->lock, flags);
+	spin_lock_irqsave(&q->lock, flags);
+	*q->rx_tail = pkt;
+	q->rx_tail = &pkt->next;
+	spin_unlock_irqrestore(&q->lock, flags);
 }
 
-static void snull_interrupt(struct net_device *dev, int interrupt)
+/*
+ * The zero-copy RX queue is protected by the queue pair lock, as the
+ * snull_buff RX queue, not by its own sk_buff_head lock.
+ */
+static struct sk_buff *dequeue_rx_skb(struct snull_queue *q)
 {
-	struct snull_dev *s = netdev_priv(dev);
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&q->lock, flags);
+	skb = __skb_dequeue(&q->rx_skbs);
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	return skb;
+}
+
+/* false when the RX queue is full, as there is no pool to stop TX */
+static bool enqueue_rx_skb(struct snull_queue *q, struct sk_buff *skb)
+{
+	unsigned long flags;
+	bool queued = false;
+
+	spin_lock_irqsave(&q->lock, flags);
+	if (skb_queue_len(&q->rx_skbs) < SNULL_RX_SKB_QUEUE_LEN) {
+		__skb_queue_tail(&q->rx_skbs, skb);
+		queued = true;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	return queued;
+}
+
+/* each queue pair has its own interrupt line, e.g. the MSI-X vector */
+static void snull_interrupt(struct snull_queue *q, int interrupt)
+{
+	struct snull_dev *s = netdev_priv(q->dev);
 	unsigned long flags;
 
-	spin_lock_irqsave(&s->lock, flags);
-	s->status |= interrupt;
-	spin_unlock_irqrestore(&s->lock, flags);
+	spin_lock_irqsave(&q->lock, flags);
+	q->status |= interrupt;
+	spin_unlock_irqrestore(&q->lock, flags);
 
 	if (s->interrupt)
-		s->interrupt(0, dev, NULL);
+		s->interrupt(q->index, q, NULL);
 }
 
-static int snull_hw_tx(char *data, int len, struct net_device *dev)
+/*
+ * mask or unmask the RX interrupt.  It's level triggered, e.g. the
+ * interrupt is raised again when it's unmasked with the pending RX
+ * packets, which were queued while it was masked.
+ */
+static void snull_rx_ints(struct snull_queue *q, int enable)
 {
-	struct net_device *dst;
-	struct snull_buff *b;
-	struct iphdr *ih;
-	u32 *saddr, *daddr;
-	int lockup;
+	unsigned long flags;
+	int pending;
 
-	netdev_info(dev, "%s\n", __FUNCTION__);
+	spin_lock_irqsave(&q->lock, flags);
+	q->rx_int_enabled = enable;
+	pending = enable && (q->rx_queue || !skb_queue_empty(&q->rx_skbs));
+	spin_unlock_irqrestore(&q->lock, flags);
 
-	/* to avoid the crash */
-	if (len < (sizeof(struct ethhdr) + sizeof(struct iphdr))) {
-		netdev_warn(dev, "ignore short packet(len=%d)\n", len);
-		return -EINVAL;
-	}
+	if (pending)
+		snull_interrupt(q, SNULL_RX_INTR);
+}
+
+static void snull_flip_ip(struct iphdr *ih)
+{
+	u32 *saddr, *daddr;
 
 	/* flip the least significant bit of the third octects */
-	ih = (struct iphdr *)(data + sizeof(struct ethhdr));
 	saddr = &ih->saddr;
 	daddr = &ih->daddr;
 	((u8 *)saddr)[2] ^= 1;
@@ -208,38 +365,171 @@ static int snull_hw_tx(char *data, int len, struct net_device *dev)
 	/* recalculate the IP header checksum */
 	ih->check = 0;
 	ih->check = ip_fast_csum((const void *)ih, ih->ihl);
+}
+
+/* simulate the TX lockup, or just complete the TX */
+static void snull_hw_tx_done(struct snull_queue *q)
+{
+	int lockup;
 
-	/* get the buffer to hold the new packet */
-	b = dequeue_pool(dev);
+	lockup = snull_tx_lockup();
+	if (unlikely(lockup && (++q->tx_count % lockup) == 0)) {
+		netif_tx_stop_queue(snull_txq(q));
+	} else {
+		/* done with the tx */
+		snull_interrupt(q, SNULL_TX_INTR);
+	}
+}
+
+/* get the buffer to hold the new packet of len bytes */
+static struct snull_buff *snull_hw_tx_buff(struct snull_queue *q, int len)
+{
+	struct snull_buff *b;
+
+	/* to avoid the crash */
+	if (len < (sizeof(struct ethhdr) + sizeof(struct iphdr))) {
+		if (net_ratelimit())
+			netdev_warn(q->dev, "ignore short packet(len=%d)\n",
+				    len);
+		return ERR_PTR(-EINVAL);
+	}
+	b = dequeue_pool(q);
 	if (unlikely(!b))
-		return -ENOMEM;
-	b->datalen = len;
-	memcpy(b->data, data, len);
+		return ERR_PTR(-ENOMEM);
+	if (unlikely(max_t(int, len, ETH_ZLEN) > b->size)) {
+		/* allocated before the MTU change */
+		enqueue_pool(q, b);
+		return ERR_PTR(-EMSGSIZE);
+	}
+	b->offset = SNULL_HEADROOM;
+	return b;
+}
+
+/* pad the runt, and put the buffer on the wire */
+static void snull_hw_tx_wire(struct snull_queue *q, struct snull_buff *b,
+			     int len)
+{
+	u8 *frame = b->data + b->offset;
+	struct snull_queue *dst;
+
+	b->datalen = max_t(int, len, ETH_ZLEN);
+	memset(frame + len, 0, b->datalen - len);
+	snull_flip_ip((struct iphdr *)(frame + sizeof(struct ethhdr)));
 
 	/* put it in the destination RX queue, and trigger the interrupt */
-	dst = dest_dev(dev);
+	dst = dest_queue(q);
 	enqueue_rx(dst, b);
-	snull_interrupt(dst, SNULL_RX_INTR);
+	if (dst->rx_int_enabled)
+		snull_interrupt(dst, SNULL_RX_INTR);
 
-	/* simulate the TX lockup */
-	lockup = snull_tx_lockup();
-	if (unlikely(lockup && ((dev->stats.tx_packets + 1) % lockup) == 0)) {
-		netif_stop_queue(dev);
-	} else {
-		/* done with the tx */
-		snull_interrupt(dev, SNULL_TX_INTR);
+	snull_hw_tx_done(q);
+}
+
+/* linearize the non-GSO skb into the buffer */
+static int snull_hw_tx(struct sk_buff *skb, struct snull_queue *q)
+{
+	struct snull_buff *b;
+
+	trace_snull_hw_tx(q->dev, q->index, skb->len);
+
+	b = snull_hw_tx_buff(q, skb->len);
+	if (IS_ERR(b))
+		return PTR_ERR(b);
+	if (unlikely(skb_copy_bits(skb, 0, b->data + b->offset, skb->len))) {
+		enqueue_pool(q, b);
+		return -EFAULT;
 	}
+	snull_hw_tx_wire(q, b, skb->len);
+	return 0;
+}
 
+/* XDP version of snull_hw_tx(), which copies the frame */
+static int snull_hw_tx_xdp(const void *data, int len, struct snull_queue *q)
+{
+	struct snull_buff *b;
+
+	trace_snull_hw_tx(q->dev, q->index, len);
+
+	b = snull_hw_tx_buff(q, len);
+	if (IS_ERR(b))
+		return PTR_ERR(b);
+	memcpy(b->data + b->offset, data, len);
+	snull_hw_tx_wire(q, b, len);
+	return 0;
+}
+
+/*
+ * zero-copy version of snull_hw_tx(), which rewrites the IP header
+ * in place and hands the skb itself to the peer.  The header is
+ * copied only when it's shared with a clone, e.g. the TCP one kept
+ * for the retransmission, and the payload is never copied.  The skb
+ * is consumed even on error.
+ */
+static int snull_hw_tx_skb(struct sk_buff *skb, struct snull_queue *q)
+{
+	struct net_device *dev = q->dev;
+	struct snull_queue *dst;
+	struct iphdr *ih;
+	int err;
+
+	trace_snull_hw_tx(dev, q->index, skb->len);
+
+	/* to avoid the crash */
+	if (skb->len < (sizeof(struct ethhdr) + sizeof(struct iphdr))) {
+		if (net_ratelimit())
+			netdev_warn(dev, "ignore short packet(len=%d)\n",
+				    skb->len);
+		err = -EINVAL;
+		goto drop;
+	}
+	err = skb_ensure_writable(skb, sizeof(struct ethhdr) +
+				  sizeof(struct iphdr));
+	if (err)
+		goto drop;
+	ih = (struct iphdr *)(skb->data + sizeof(struct ethhdr));
+	err = skb_ensure_writable(skb, sizeof(struct ethhdr) + ih->ihl*4);
+	if (err)
+		goto drop;
+	snull_flip_ip((struct iphdr *)(skb->data + sizeof(struct ethhdr)));
+
+	/* scrub the TX state, e.g. the socket, and pull the ether header */
+	dst = dest_queue(q);
+	if (__dev_forward_skb(dst->dev, skb))
+		goto done; /* dropped and counted by the peer */
+	if (unlikely(!enqueue_rx_skb(dst, skb))) {
+		snull_stats_add(dst->dev, rx_dropped, 1);
+		kfree_skb(skb);
+		goto done;
+	}
+	if (dst->rx_int_enabled)
+		snull_interrupt(dst, SNULL_RX_INTR);
+done:
+	snull_hw_tx_done(q);
 	return 0;
+drop:
+	kfree_skb(skb);
+	return err;
 }
 
 /* net_device_ops */
 static int snull_open(struct net_device *dev)
 {
+	int err;
+	int i;
+
 	netdev_info(dev, "%s\n", __FUNCTION__);
 
-	/* initialize the TX buffers. */
-	init_pool(dev);
+	/* initialize the TX buffers, and the XDP RX queue info. */
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		struct snull_queue *q = snull_queue(dev, i);
+
+		err = init_pool(q);
+		if (err)
+			goto unwind;
+		err = xdp_rxq_info_reg(&q->xdp_rxq, dev, i);
+		if (err)
+			goto unwind;
+	}
 
 	/*
 	 * Assign the hardware address of the board: use "\0SNULx",
@@ -250,61 +540,369 @@ static int snull_open(struct net_device *dev)
 	if (dev == netdevs[1])
 		dev->dev_addr[ETH_ALEN-1]++;
 	dev->watchdog_timeo = snull_tx_timeout_tick();
-	netif_start_queue(dev);
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		struct snull_queue *q = snull_queue(dev, i);
+		int cpu = cpumask_local_spread(i, NUMA_NO_NODE);
+
+		/*
+		 * XPS, one CPU per queue, so that the local CPU always
+		 * picks the same queue.  Just a hint, ignore the error.
+		 */
+		netif_set_xps_queue(dev, cpumask_of(cpu), i);
+		if (napi)
+			napi_enable(&q->napi);
+		snull_rx_ints(q, 1);
+	}
+	netif_tx_start_all_queues(dev);
 	return 0;
+unwind:
+	/* including the partially filled one */
+	free_pool(snull_queue(dev, i));
+	while (i--) {
+		struct snull_queue *q = snull_queue(dev, i);
+
+		xdp_rxq_info_unreg(&q->xdp_rxq);
+		free_pool(q);
+	}
+	return err;
 }
 
 static int snull_release(struct net_device *dev)
 {
+	int i;
+
 	netdev_info(dev, "%s\n", __FUNCTION__);
-	netif_stop_queue(dev);
-	free_pool(dev);
-	free_rx(dev);
+	netif_tx_stop_all_queues(dev);
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		struct snull_queue *q = snull_queue(dev, i);
+
+		if (napi)
+			napi_disable(&q->napi);
+		xdp_rxq_info_unreg(&q->xdp_rxq);
+		free_pool(q);
+		free_rx(q);
+	}
 	return 0;
 }
 
-static netdev_tx_t snull_tx(struct sk_buff *skb, struct net_device *dev)
+/*
+ * XXX inflight skb, to be freed at IRQ handler.  NULL skb for the
+ * frame not backed by the skb, e.g. the zero-copy or the XDP one.
+ */
+static void snull_tx_inflight(struct snull_queue *q, struct sk_buff *skb,
+			      int datalen)
 {
-	struct snull_dev *s = netdev_priv(dev);
-	char *data, shortpkt[ETH_ZLEN];
+	struct sk_buff *stale;
 	unsigned long flags;
-	int len;
 
-	netdev_info(dev, "%s\n", __FUNCTION__);
+	spin_lock_irqsave(&q->lock, flags);
+	stale = q->skb; /* left by the TX lockup */
+	q->datalen = datalen;
+	q->skb = skb;
+	spin_unlock_irqrestore(&q->lock, flags);
+	if (unlikely(stale)) {
+		snull_stats_add(q->dev, tx_dropped, 1);
+		dev_kfree_skb_any(stale);
+	}
+}
+
+/* the TX failed, the inflight skb is still owned by the caller */
+static void snull_tx_cancel(struct snull_queue *q)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&q->lock, flags);
+	q->datalen = 0;
+	q->skb = NULL;
+	spin_unlock_irqrestore(&q->lock, flags);
+}
 
-	data = skb->data;
-	len = skb->len;
-	if (len < ETH_ZLEN) {
-		memset(shortpkt, 0, ETH_ZLEN);
-		memcpy(shortpkt, skb->data, skb->len);
-		data = shortpkt;
-		len = ETH_ZLEN;
+/* hand the non-GSO skb to the hardware, the skb is kept on error */
+static int snull_xmit(struct sk_buff *skb, struct snull_queue *q)
+{
+	int err;
+
+	/* the checksum offload, done by the hardware */
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		err = skb_checksum_help(skb);
+		if (err)
+			return err;
 	}
 
-	/* XXX inflight skb, to be freed at IRQ handler */
-	spin_lock_irqsave(&s->lock, flags);
-	s->datalen = len;
-	s->skb = skb;
-	spin_unlock_irqrestore(&s->lock, flags);
+	snull_tx_inflight(q, skb, max_t(int, skb->len, ETH_ZLEN));
+	err = snull_hw_tx(skb, q);
+	if (err)
+		snull_tx_cancel(q);
+	return err;
+}
+
+/*
+ * software TSO/GSO, which segments the skb with the checksum, as the
+ * hardware only takes the frame up to the MTU.  The pool has enough
+ * buffer for all the segments, as the queue is stopped otherwise.
+ */
+static netdev_tx_t snull_tx_gso(struct sk_buff *skb, struct snull_queue *q)
+{
+	struct sk_buff *segs, *next;
 
-	if (snull_hw_tx(data, len, dev)) {
-		dev->stats.tx_errors++;
-		return NETDEV_TX_BUSY;
+	segs = skb_gso_segment(skb, 0);
+	if (IS_ERR_OR_NULL(segs)) {
+		snull_stats_add(q->dev, tx_errors, 1);
+		dev_kfree_skb_any(skb);
+		return NETDEV_TX_OK;
+	}
+	dev_consume_skb_any(skb);
+
+	for (; segs; segs = next) {
+		next = segs->next;
+		segs->next = NULL;
+		if (snull_xmit(segs, q)) {
+			snull_stats_add(q->dev, tx_errors, 1);
+			dev_kfree_skb_any(segs);
+		}
 	}
 	return NETDEV_TX_OK;
 }
 
+static netdev_tx_t snull_tx(struct sk_buff *skb, struct net_device *dev)
+{
+	struct snull_queue *q = snull_queue(dev, skb_get_queue_mapping(skb));
+	int err;
+
+	trace_snull_tx(dev, q->index, skb->len);
+
+	if (zerocopy) {
+		/* the skb is owned by the peer, nothing to free on TX done */
+		snull_tx_inflight(q, NULL, skb->len);
+		if (snull_hw_tx_skb(skb, q)) {
+			snull_tx_cancel(q);
+			snull_stats_add(dev, tx_errors, 1);
+		}
+		return NETDEV_TX_OK;
+	}
+
+	if (skb_is_gso(skb))
+		return snull_tx_gso(skb, q);
+
+	err = snull_xmit(skb, q);
+	if (err) {
+		/* no buffer, drop it rather than the busy loop of requeue */
+		if (err == -ENOMEM)
+			snull_stats_add(dev, tx_dropped, 1);
+		else
+			snull_stats_add(dev, tx_errors, 1);
+		dev_kfree_skb_any(skb);
+	}
+	return NETDEV_TX_OK;
+}
+
+/* the pool is sized by the MTU at open */
+static int snull_change_mtu(struct net_device *dev, int new_mtu)
+{
+	struct snull_dev *s = netdev_priv(dev);
+
+	if (netif_running(dev))
+		return -EBUSY;
+	if (rtnl_dereference(s->xdp_prog) && new_mtu > SNULL_XDP_MAX_MTU)
+		return -EINVAL;
+	dev->mtu = new_mtu;
+	return 0;
+}
+
+/* kick only the stuck queues */
 static void snull_tx_timeout(struct net_device *dev)
 {
+	int i;
+
 	netdev_info(dev, "%s\n", __FUNCTION__);
-	snull_interrupt(dev, SNULL_TX_INTR|SNULL_TX_TIMEOUT);
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		struct snull_queue *q = snull_queue(dev, i);
+
+		if (netif_xmit_stopped(snull_txq(q))) {
+			trace_snull_tx_timeout(dev, q->index);
+			snull_interrupt(q, SNULL_TX_INTR|SNULL_TX_TIMEOUT);
+		}
+	}
+}
+
+/*
+ * XDP_TX and ndo_xdp_xmit, serialized with the stack by the TX queue
+ * lock, as the pool has the single consumer.
+ */
+static int snull_xdp_tx(struct snull_queue *q, const void *data, int len)
+{
+	struct netdev_queue *txq = snull_txq(q);
+	int err = -EBUSY;
+
+	__netif_tx_lock(txq, smp_processor_id());
+	if (!netif_xmit_frozen_or_stopped(txq)) {
+		snull_tx_inflight(q, NULL, max_t(int, len, ETH_ZLEN));
+		err = snull_hw_tx_xdp(data, len, q);
+		if (err)
+			snull_tx_cancel(q);
+	}
+	__netif_tx_unlock(txq);
+
+	return err;
+}
+
+/*
+ * the XDP_REDIRECT target.  The frame is a page fragment, which is
+ * released with page_frag_free() once it's copied into the pool.
+ */
+static int snull_xdp_xmit(struct net_device *dev, struct xdp_buff *xdp)
+{
+	struct snull_queue *q;
+	int err;
+
+	/* the peer only takes the skb in the zero-copy mode */
+	if (zerocopy)
+		return -EOPNOTSUPP;
+	if (unlikely(!netif_running(dev)))
+		return -ENETDOWN;
+
+	q = snull_queue(dev, smp_processor_id() % dev->real_num_tx_queues);
+	err = snull_xdp_tx(q, xdp->data, xdp->data_end - xdp->data);
+	if (err)
+		return err;
+	page_frag_free(xdp->data);
+	return 0;
+}
+
+/* nothing to flush, as the frame is on the wire by snull_xdp_xmit() */
+static void snull_xdp_flush(struct net_device *dev)
+{
+}
+
+static int snull_xdp_setup(struct net_device *dev, struct bpf_prog *prog,
+			   struct netlink_ext_ack *extack)
+{
+	struct snull_dev *s = netdev_priv(dev);
+	struct bpf_prog *old;
+
+	if (!napi || zerocopy) {
+		NL_SET_ERR_MSG(extack, "native XDP needs napi=1 and zerocopy=0");
+		return -EOPNOTSUPP;
+	}
+	if (prog && dev->mtu > SNULL_XDP_MAX_MTU) {
+		NL_SET_ERR_MSG(extack, "MTU too large for XDP");
+		return -EINVAL;
+	}
+
+	/* the reference is passed by the caller */
+	old = rtnl_dereference(s->xdp_prog);
+	rcu_assign_pointer(s->xdp_prog, prog);
+	if (old)
+		bpf_prog_put(old);
+	return 0;
+}
+
+static int snull_bpf(struct net_device *dev, struct netdev_bpf *bpf)
+{
+	struct snull_dev *s = netdev_priv(dev);
+	struct bpf_prog *prog;
+
+	switch (bpf->command) {
+	case XDP_SETUP_PROG:
+		return snull_xdp_setup(dev, bpf->prog, bpf->extack);
+	case XDP_QUERY_PROG:
+		prog = rtnl_dereference(s->xdp_prog);
+		bpf->prog_attached = !!prog;
+		bpf->prog_id = prog ? prog->aux->id : 0;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static void snull_get_stats64(struct net_device *dev,
+			      struct rtnl_link_stats64 *stats)
+{
+	struct snull_dev *s = netdev_priv(dev);
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		const struct snull_stats *st = per_cpu_ptr(s->stats, cpu);
+		u64 rx_packets, rx_bytes, rx_dropped;
+		u64 tx_packets, tx_bytes, tx_errors, tx_dropped;
+		unsigned int start;
+
+		do {
+			start = u64_stats_fetch_begin_irq(&st->syncp);
+			rx_packets = st->rx_packets;
+			rx_bytes = st->rx_bytes;
+			rx_dropped = st->rx_dropped;
+			tx_packets = st->tx_packets;
+			tx_bytes = st->tx_bytes;
+			tx_errors = st->tx_errors;
+			tx_dropped = st->tx_dropped;
+		} while (u64_stats_fetch_retry_irq(&st->syncp, start));
+
+		stats->rx_packets += rx_packets;
+		stats->rx_bytes += rx_bytes;
+		stats->rx_dropped += rx_dropped;
+		stats->tx_packets += tx_packets;
+		stats->tx_bytes += tx_bytes;
+		stats->tx_errors += tx_errors;
+		stats->tx_dropped += tx_dropped;
+	}
+}
+
+static int snull_poll(struct napi_struct *n, int budget);
+
+/* the queue counts are only set after the setup, see snull_init() */
+static int snull_dev_init(struct net_device *dev)
+{
+	struct snull_dev *s = netdev_priv(dev);
+	int i;
+
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		struct snull_queue *q = snull_queue(dev, i);
+
+		spin_lock_init(&q->lock);
+		init_llist_head(&q->pool);
+		q->rx_queue = NULL;
+		q->rx_tail = &q->rx_queue;
+		__skb_queue_head_init(&q->rx_skbs);
+		q->rx_int_enabled = 1;
+		q->index = i;
+		q->dev = dev;
+		if (napi)
+			netif_napi_add(dev, &q->napi, snull_poll,
+				       max(napi_budget, 1));
+	}
+
+	s->stats = netdev_alloc_pcpu_stats(struct snull_stats);
+	if (!s->stats)
+		return -ENOMEM;
+	return 0;
+}
+
+static void snull_dev_uninit(struct net_device *dev)
+{
+	struct snull_dev *s = netdev_priv(dev);
+	struct bpf_prog *prog;
+
+	free_percpu(s->stats);
+	s->stats = NULL;
+	prog = rtnl_dereference(s->xdp_prog);
+	RCU_INIT_POINTER(s->xdp_prog, NULL);
+	if (prog)
+		bpf_prog_put(prog);
 }
 
 const static struct net_device_ops snull_ops = {
-	.ndo_open	= snull_open,
-	.ndo_stop	= snull_release,
-	.ndo_start_xmit	= snull_tx,
-	.ndo_tx_timeout	= snull_tx_timeout,
+	.ndo_init		= snull_dev_init,
+	.ndo_uninit		= snull_dev_uninit,
+	.ndo_open		= snull_open,
+	.ndo_stop		= snull_release,
+	.ndo_start_xmit		= snull_tx,
+	.ndo_tx_timeout		= snull_tx_timeout,
+	.ndo_change_mtu		= snull_change_mtu,
+	.ndo_get_stats64	= snull_get_stats64,
+	.ndo_bpf		= snull_bpf,
+	.ndo_xdp_xmit		= snull_xdp_xmit,
+	.ndo_xdp_flush		= snull_xdp_flush,
 };
 
 /* header_ops */
@@ -336,87 +934,268 @@ const static struct header_ops snull_header_ops = {
 	.create		= snull_header,
 };
 
-static int snull_rx(struct net_device *dev, struct snull_buff *pkt)
+/*
+ * deliver the skb, of which the ether header is already pulled.  The
+ * zero-copy GSO skb keeps CHECKSUM_PARTIAL, to be segmented again.
+ */
+static int snull_rx_skb(struct snull_queue *q, struct sk_buff *skb)
+{
+	struct net_device *dev = q->dev;
+
+	if (skb->ip_summed != CHECKSUM_PARTIAL)
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+	skb_record_rx_queue(skb, q->index);
+	snull_stats_add(dev, rx_packets, 1);
+	snull_stats_add(dev, rx_bytes, skb->len + ETH_HLEN);
+	if (napi) {
+		napi_gro_receive(&q->napi, skb);
+		return 0;
+	}
+	return netif_rx(skb);
+}
+
+/*
+ * XDP_REDIRECT target releases the frame with page_frag_free(), so
+ * the frame is copied out of the buffer into the page fragment.
+ */
+static int snull_xdp_redirect(struct snull_queue *q, struct xdp_buff *xdp,
+			      struct bpf_prog *prog)
+{
+	int len = xdp->data_end - xdp->data;
+	struct xdp_buff frag;
+	void *buf;
+	int err;
+
+	buf = napi_alloc_frag(SNULL_XDP_FRAG_SIZE(len));
+	if (unlikely(!buf))
+		return -ENOMEM;
+	frag.data_hard_start = buf;
+	frag.data = buf + XDP_PACKET_HEADROOM;
+	frag.data_end = frag.data + len;
+	xdp_set_data_meta_invalid(&frag);
+	frag.rxq = xdp->rxq;
+	memcpy(frag.data, xdp->data, len);
+
+	err = xdp_do_redirect(q->dev, &frag, prog);
+	if (err)
+		page_frag_free(buf);
+	return err;
+}
+
+/*
+ * run the XDP program on the buffer, before the skb allocation.  The
+ * program may move the XDP_PASS frame within the buffer, which goes
+ * back to the pool in any case, as XDP_TX and XDP_REDIRECT copy it.
+ */
+static u32 snull_rx_xdp(struct snull_queue *q, struct snull_buff *pkt)
+{
+	struct snull_dev *s = netdev_priv(q->dev);
+	struct bpf_prog *prog;
+	struct xdp_buff xdp;
+	u32 act = XDP_PASS;
+
+	rcu_read_lock();
+	prog = rcu_dereference(s->xdp_prog);
+	if (!prog)
+		goto out;
+
+	xdp.data_hard_start = pkt->data;
+	xdp.data = pkt->data + pkt->offset;
+	xdp.data_end = xdp.data + pkt->datalen;
+	xdp_set_data_meta_invalid(&xdp);
+	xdp.rxq = &q->xdp_rxq;
+
+	act = bpf_prog_run_xdp(prog, &xdp);
+	switch (act) {
+	case XDP_PASS:
+		pkt->offset = xdp.data - (void *)pkt->data;
+		pkt->datalen = xdp.data_end - xdp.data;
+		break;
+	case XDP_TX:
+		/* bounce it back to the source, e.g. dest_dev(q->dev) */
+		if (snull_xdp_tx(q, xdp.data, xdp.data_end - xdp.data)) {
+			trace_xdp_exception(q->dev, prog, act);
+			act = XDP_DROP;
+		}
+		break;
+	case XDP_REDIRECT:
+		if (snull_xdp_redirect(q, &xdp, prog)) {
+			trace_xdp_exception(q->dev, prog, act);
+			act = XDP_DROP;
+		} else
+			q->xdp_flush = true;
+		break;
+	default:
+		bpf_warn_invalid_xdp_action(act);
+		/* fall through */
+	case XDP_ABORTED:
+		trace_xdp_exception(q->dev, prog, act);
+		/* fall through */
+	case XDP_DROP:
+		act = XDP_DROP;
+		break;
+	}
+	if (act == XDP_DROP)
+		snull_stats_add(q->dev, rx_dropped, 1);
+out:
+	rcu_read_unlock();
+	return act;
+}
+
+static int snull_rx(struct snull_queue *q, struct snull_buff *pkt)
 {
+	struct net_device *dev = q->dev;
 	struct sk_buff *skb;
 	int err = -ENOMEM;
 
-	netdev_info(dev, "%s\n", __FUNCTION__);
+	trace_snull_rx(dev, q->index, pkt->datalen);
+
+	/* consumed by XDP */
+	if (snull_rx_xdp(q, pkt) != XDP_PASS)
+		return 0;
 
 	skb = dev_alloc_skb(pkt->datalen + 2);
 	if (unlikely(!skb)) {
-		if (printk_ratelimit())
+		if (net_ratelimit())
 			netdev_warn(dev, "low on mem - dropped");
-		dev->stats.rx_dropped++;
+		snull_stats_add(dev, rx_dropped, 1);
 		goto out;
 	}
 	skb_reserve(skb, 2); /* 16 alignment */
-	memcpy(skb_put(skb, pkt->datalen), pkt->data, pkt->datalen);
+	memcpy(skb_put(skb, pkt->datalen), pkt->data + pkt->offset,
+	       pkt->datalen);
 
 	skb->dev = dev;
 	skb->protocol = eth_type_trans(skb, dev);
-	skb->ip_summed = CHECKSUM_UNNECESSARY;
-	dev->stats.rx_packets++;
-	dev->stats.rx_bytes += pkt->datalen;
-	err = netif_rx(skb);
+	err = snull_rx_skb(q, skb);
 out:
 	return err;
 }
 
+/* receive a packet from the RX queue, -EAGAIN if it's empty */
+static int snull_rx_one(struct snull_queue *q)
+{
+	struct snull_buff *pkt;
+	struct sk_buff *skb;
+	int err;
+
+	if (zerocopy) {
+		skb = dequeue_rx_skb(q);
+		if (!skb)
+			return -EAGAIN;
+		trace_snull_rx(q->dev, q->index, skb->len + ETH_HLEN);
+		return snull_rx_skb(q, skb);
+	}
+	pkt = dequeue_rx(q);
+	if (!pkt)
+		return -EAGAIN;
+	err = snull_rx(q, pkt);
+	/* queue it back to the source queue pool */
+	enqueue_pool(dest_queue(q), pkt);
+	return err;
+}
+
+/* NAPI poll, which drains the RX queue up to the budget */
+static int snull_poll(struct napi_struct *n, int budget)
+{
+	struct snull_queue *q = container_of(n, struct snull_queue, napi);
+	int npackets = 0;
+
+	while (npackets < budget && snull_rx_one(q) != -EAGAIN)
+		npackets++;
+	if (q->xdp_flush) {
+		q->xdp_flush = false;
+		xdp_do_flush_map();
+	}
+
+	/* all drained, back to the interrupt driven mode */
+	if (npackets < budget && napi_complete_done(n, npackets))
+		snull_rx_ints(q, 1);
+
+	return npackets;
+}
+
+/* TX completion, shared by both of the interrupt handlers */
+static void snull_tx_done(struct snull_queue *q, int status)
+{
+	struct sk_buff *skb;
+	int datalen;
+
+	spin_lock(&q->lock);
+	datalen = q->datalen;
+	q->datalen = 0;
+	skb = q->skb;
+	q->skb = NULL;
+	spin_unlock(&q->lock);
+	if (skb)
+		dev_kfree_skb(skb);
+	if (datalen) {
+		snull_stats_add(q->dev, tx_packets, 1);
+		snull_stats_add(q->dev, tx_bytes, datalen);
+	}
+	if (status & SNULL_TX_TIMEOUT) {
+		snull_stats_add(q->dev, tx_dropped, 1);
+		netif_tx_wake_queue(snull_txq(q));
+	}
+}
+
 /* old/regular interrupt handler */
 static irqreturn_t snull_regular_interrupt(int irq, void *dev_id,
 					   struct pt_regs *regs)
 {
-	struct net_device *dev = (struct net_device *) dev_id;
-	struct snull_dev *s;
+	struct snull_queue *q = (struct snull_queue *) dev_id;
 	int status;
 	int err = 0;
 
-	if (!dev)
+	if (!q)
 		return IRQ_NONE;
 
 	/* status flag */
-	s = netdev_priv(dev);
-	spin_lock(&s->lock);
-	status = s->status;
-	s->status = 0;
-	spin_unlock(&s->lock);
+	spin_lock(&q->lock);
+	status = q->status;
+	q->status = 0;
+	spin_unlock(&q->lock);
 
 	if (status & SNULL_RX_INTR) {
-		struct snull_buff *pkt = dequeue_rx(dev);
-		if (pkt) {
-			err = snull_rx(dev, pkt);
-			/* queue it back to the source dev pool */
-			enqueue_pool(dest_dev(dev), pkt);
-		}
-	}
-	if (status & SNULL_TX_INTR) {
-		struct sk_buff *skb;
-		int datalen;
-
-		spin_lock(&s->lock);
-		datalen = s->datalen;
-		s->datalen = 0;
-		skb = s->skb;
-		s->skb = NULL;
-		spin_unlock(&s->lock);
-		if (skb)
-			dev_kfree_skb(skb);
-		if (datalen) {
-			dev->stats.tx_packets++;
-			dev->stats.tx_bytes += datalen;
-		}
-		if (status & SNULL_TX_TIMEOUT) {
-			dev->stats.tx_dropped++;
-			netif_wake_queue(dev);
-		}
+		err = snull_rx_one(q);
+		if (err == -EAGAIN)
+			err = 0;
 	}
+	if (status & SNULL_TX_INTR)
+		snull_tx_done(q, status);
 
 	if (err)
 		return IRQ_NONE;
 	return IRQ_HANDLED;
 }
 
+/* NAPI interrupt handler, which only schedules the RX poll */
+static irqreturn_t snull_napi_interrupt(int irq, void *dev_id,
+					struct pt_regs *regs)
+{
+	struct snull_queue *q = (struct snull_queue *) dev_id;
+	int status;
+
+	if (!q)
+		return IRQ_NONE;
+
+	/* status flag */
+	spin_lock(&q->lock);
+	status = q->status;
+	q->status = 0;
+	spin_unlock(&q->lock);
+
+	if (status & SNULL_RX_INTR) {
+		/* mask the RX interrupt until the poll is done */
+		snull_rx_ints(q, 0);
+		napi_schedule(&q->napi);
+	}
+	if (status & SNULL_TX_INTR)
+		snull_tx_done(q, status);
+
+	return IRQ_HANDLED;
+}
+
 static void snull_init(struct net_device *dev)
 {
 	struct snull_dev *s = netdev_priv(dev);
@@ -426,13 +1205,27 @@ static void snull_init(struct net_device *dev)
 	dev->netdev_ops	= &snull_ops;
 	dev->header_ops = &snull_header_ops;
 	dev->flags	|= IFF_NOARP;
-	s->interrupt	= snull_regular_interrupt;
+	dev->max_mtu	= SNULL_MAX_MTU;
+	dev->hw_features = NETIF_F_SG|NETIF_F_HW_CSUM|NETIF_F_TSO;
+	dev->features	|= dev->hw_features;
+	dev->gso_max_segs = SNULL_GSO_MAX_SEGS;
+	if (napi)
+		s->interrupt = snull_napi_interrupt;
+	else
+		s->interrupt = snull_regular_interrupt;
+}
+
+/* TX/RX queue pairs, capped to SNULL_MAX_QUEUES */
+static int snull_queues(void)
+{
+	int n = queues > 0 ? queues : num_online_cpus();
 
-	spin_lock_init(&s->lock);
+	return clamp(n, 1, SNULL_MAX_QUEUES);
 }
 
 static int __init snull_init_module(void)
 {
+	int nqueues = snull_queues();
 	int i;
 
 	pr_info("%s\n", __FUNCTION__);
@@ -441,8 +1234,11 @@ static int __init snull_init_module(void)
 		struct net_device *dev;
 		int err;
 
-		dev = alloc_netdev(sizeof(struct snull_dev), "sn%d",
-				   NET_NAME_UNKNOWN, snull_init);
+		/* both ends have the same number of pairs */
+		dev = alloc_netdev_mqs(sizeof(struct snull_dev) +
+				       nqueues * sizeof(struct snull_queue),
+				       "sn%d", NET_NAME_UNKNOWN, snull_init,
+				       nqueues, nqueues);
 		if (!dev)
 			goto unregister;
 
@@ -0,0 +1,285 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/utsname.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define BENCH_NAME	"snull_bench"
+#define BENCH_TX_DEV	"sn0"
+#define BENCH_RX_DEV	"sn1"
+#define BENCH_SADDR	"1.1.0.1"
+#define BENCH_DADDR	"1.1.0.2"	/* 1.1.1.2 on sn1, after the flip */
+#define BENCH_PORT	9		/* discard */
+#define BENCH_DURATION	1		/* sec */
+#define MAX_FRAME_LEN	ETH_FRAME_LEN
+
+/* the receiver on BENCH_RX_DEV */
+struct bench {
+	int	sock;
+	int	stop;
+	long	rx;
+};
+
+static struct utsname uts;
+
+/* tab separated kernel release, benchmark, case, metric and value */
+static void report(const char *name, const char *metric, double value)
+{
+	printf("%s\t%s\t%s\t%s\t%.3f\n", uts.release, BENCH_NAME, name,
+	       metric, value);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static unsigned short ip_csum(const void *data, int len)
+{
+	const unsigned short *p = data;
+	unsigned int sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/* bring the interface up, and return the original flags */
+static int if_up(int sock, const char *name, short *flags)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, IFNAMSIZ-1);
+	if (ioctl(sock, SIOCGIFFLAGS, &ifr) == -1)
+		return -1;
+	*flags = ifr.ifr_flags;
+	ifr.ifr_flags |= IFF_UP;
+	return ioctl(sock, SIOCSIFFLAGS, &ifr);
+}
+
+static void if_restore(int sock, const char *name, short flags)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, IFNAMSIZ-1);
+	ifr.ifr_flags = flags;
+	ioctl(sock, SIOCSIFFLAGS, &ifr);
+}
+
+/* packet socket bound to the interface, for the IPv4 frames */
+static int packet_socket(const char *name)
+{
+	struct sockaddr_ll sll;
+	struct timeval tv = { .tv_usec = 100000 };
+	int sock;
+
+	sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+	if (sock == -1)
+		return -1;
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_IP);
+	sll.sll_ifindex = if_nametoindex(name);
+	if (!sll.sll_ifindex ||
+	    bind(sock, (struct sockaddr *)&sll, sizeof(sll)) == -1 ||
+	    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/* UDP over IPv4 frame to BENCH_DADDR, of len bytes on the wire */
+static int build_frame(int sock, unsigned char *frame, int len)
+{
+	struct ethhdr *eth = (struct ethhdr *)frame;
+	struct iphdr *ih = (struct iphdr *)(eth + 1);
+	struct udphdr *uh = (struct udphdr *)(ih + 1);
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, BENCH_TX_DEV, IFNAMSIZ-1);
+	if (ioctl(sock, SIOCGIFHWADDR, &ifr) == -1)
+		return -1;
+
+	/* dest is us xor 1, same as snull_header() */
+	memset(frame, 0, len);
+	memcpy(eth->h_source, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	memcpy(eth->h_dest, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	eth->h_dest[ETH_ALEN-1] ^= 0x01;
+	eth->h_proto = htons(ETH_P_IP);
+	ih->version = 4;
+	ih->ihl = sizeof(*ih)/4;
+	ih->ttl = 64;
+	ih->protocol = IPPROTO_UDP;
+	ih->tot_len = htons(len - sizeof(*eth));
+	ih->saddr = inet_addr(BENCH_SADDR);
+	ih->daddr = inet_addr(BENCH_DADDR);
+	ih->check = ip_csum(ih, sizeof(*ih));
+	uh->source = htons(BENCH_PORT);
+	uh->dest = htons(BENCH_PORT);
+	uh->len = htons(len - sizeof(*eth) - sizeof(*ih));
+	return 0;
+}
+
+/* count our frames, until stopped */
+static void *receiver(void *arg)
+{
+	unsigned char frame[MAX_FRAME_LEN];
+	struct bench *b = arg;
+	const struct iphdr *ih = (struct iphdr *)(frame + sizeof(struct ethhdr));
+	const struct udphdr *uh = (struct udphdr *)(ih + 1);
+	int ret;
+
+	while (!__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE)) {
+		ret = recv(b->sock, frame, sizeof(frame), 0);
+		if (ret < (int)(sizeof(struct ethhdr) + sizeof(*ih) + sizeof(*uh)))
+			continue;
+		if (ih->protocol == IPPROTO_UDP && uh->dest == htons(BENCH_PORT))
+			b->rx++;
+	}
+	return NULL;
+}
+
+static int pps_bench(int *i)
+{
+	const struct test {
+		const char	*name;
+		int		len;
+	} tests[] = {
+		{
+			.name	= "sn0-sn1-64B",
+			.len	= 64,
+		},
+		{
+			.name	= "sn0-sn1-512B",
+			.len	= 512,
+		},
+		{
+			.name	= "sn0-sn1-1514B",
+			.len	= ETH_FRAME_LEN,
+		},
+		{ /* sentry */ },
+	};
+	unsigned char frame[MAX_FRAME_LEN];
+	short tx_flags, rx_flags;
+	const struct test *t;
+	int fail = 0;
+	int ctl;
+
+	ctl = socket(AF_INET, SOCK_DGRAM, 0);
+	if (ctl == -1) {
+		perror("socket");
+		return 1;
+	}
+	if (if_up(ctl, BENCH_TX_DEV, &tx_flags)) {
+		perror(BENCH_TX_DEV);
+		close(ctl);
+		return 1;
+	}
+	if (if_up(ctl, BENCH_RX_DEV, &rx_flags)) {
+		perror(BENCH_RX_DEV);
+		if_restore(ctl, BENCH_TX_DEV, tx_flags);
+		close(ctl);
+		return 1;
+	}
+	for (t = tests; t->name; t++) {
+		struct bench b = { .sock = -1 };
+		long tx = 0, dropped = 0;
+		double start, elapsed;
+		pthread_t rx;
+		int sock;
+
+		fprintf(stderr, "%2d) %-70s", (*i)++, t->name);
+
+		sock = packet_socket(BENCH_TX_DEV);
+		if (sock == -1) {
+			perror("packet_socket");
+			goto fail;
+		}
+		b.sock = packet_socket(BENCH_RX_DEV);
+		if (b.sock == -1) {
+			perror("packet_socket");
+			goto fail_close;
+		}
+		if (build_frame(ctl, frame, t->len)) {
+			perror("build_frame");
+			goto fail_close;
+		}
+		pthread_create(&rx, NULL, receiver, &b);
+
+		/* blast for the duration, with the full TX queue as drop */
+		start = now();
+		while ((elapsed = now() - start) < BENCH_DURATION) {
+			if (send(sock, frame, t->len, 0) == t->len)
+				tx++;
+			else if (errno == ENOBUFS || errno == EAGAIN)
+				dropped++;
+			else {
+				perror("send");
+				break;
+			}
+		}
+		usleep(100000); /* in flight */
+		__atomic_store_n(&b.stop, 1, __ATOMIC_RELEASE);
+		pthread_join(rx, NULL);
+		if (!tx) {
+			fprintf(stderr, "no packets sent\n");
+			goto fail_close;
+		}
+		report(t->name, "tx-pps", tx/elapsed);
+		report(t->name, "rx-pps", b.rx/elapsed);
+		report(t->name, "tx-drop-pps", dropped/elapsed);
+		report(t->name, "rx-Mbps", b.rx*t->len*8/elapsed/1e6);
+		fprintf(stderr, "%10.0fpps\n", b.rx/elapsed);
+		close(b.sock);
+		close(sock);
+		continue;
+fail_close:
+		if (b.sock != -1)
+			close(b.sock);
+		close(sock);
+fail:
+		fprintf(stderr, "FAIL\n");
+		fail++;
+	}
+	if_restore(ctl, BENCH_RX_DEV, rx_flags);
+	if_restore(ctl, BENCH_TX_DEV, tx_flags);
+	close(ctl);
+	return fail;
+}
+
+int main(void)
+{
+	int fail = 0;
+	int i = 1;
+
+	uname(&uts);
+
+	if (pps_bench(&i))
+		fail++;
+
+	return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
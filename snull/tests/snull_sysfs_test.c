@@ -28,6 +28,36 @@ static int sysfs_open_test(int *i)
 			.file_name = "/sys/module/snull/parameters/tx_timeout",
 			.flags = O_RDWR,
 		},
+		{
+			.name = "/sys/module/snull/parameters/napi file",
+			.file_name = "/sys/module/snull/parameters/napi",
+			.flags = O_RDONLY,
+		},
+		{
+			.name = "/sys/module/snull/parameters/napi_budget file",
+			.file_name = "/sys/module/snull/parameters/napi_budget",
+			.flags = O_RDONLY,
+		},
+		{
+			.name = "/sys/module/snull/parameters/queues file",
+			.file_name = "/sys/module/snull/parameters/queues",
+			.flags = O_RDONLY,
+		},
+		{
+			.name = "/sys/module/snull/parameters/zerocopy file",
+			.file_name = "/sys/module/snull/parameters/zerocopy",
+			.flags = O_RDONLY,
+		},
+		{
+			.name = "/sys/devices/virtual/net/sn0/queues/tx-0/xps_cpus file",
+			.file_name = "/sys/devices/virtual/net/sn0/queues/tx-0/xps_cpus",
+			.flags = O_RDWR,
+		},
+		{
+			.name = "/sys/devices/virtual/net/sn1/queues/rx-0/rps_cpus file",
+			.file_name = "/sys/devices/virtual/net/sn1/queues/rx-0/rps_cpus",
+			.flags = O_RDWR,
+		},
 		{
 			.name = "/sys/devices/virtual/net/sn0/ifindex file",
 			.file_name = "/sys/devices/virtual/net/sn0/ifindex",
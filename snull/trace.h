@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM snull
+
+#if !defined(_KERNEL_IN_ACTION_SNULL_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _KERNEL_IN_ACTION_SNULL_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/netdevice.h>
+
+/* per-packet events, e.g. /sys/kernel/debug/tracing/events/snull */
+DECLARE_EVENT_CLASS(snull_packet,
+	TP_PROTO(const struct net_device *dev, u16 queue, unsigned int len),
+	TP_ARGS(dev, queue, len),
+	TP_STRUCT__entry(
+		__string(	name,	dev->name	)
+		__field(	u16,	queue		)
+		__field(	unsigned int,	len	)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->queue = queue;
+		__entry->len = len;
+	),
+	TP_printk("dev=%s queue=%u len=%u",
+		  __get_str(name), __entry->queue, __entry->len)
+);
+
+/* ndo_start_xmit, before the segmentation */
+DEFINE_EVENT(snull_packet, snull_tx,
+	TP_PROTO(const struct net_device *dev, u16 queue, unsigned int len),
+	TP_ARGS(dev, queue, len)
+);
+
+/* on the wire, the frame or the zero-copy skb */
+DEFINE_EVENT(snull_packet, snull_hw_tx,
+	TP_PROTO(const struct net_device *dev, u16 queue, unsigned int len),
+	TP_ARGS(dev, queue, len)
+);
+
+/* off the RX queue, before XDP */
+DEFINE_EVENT(snull_packet, snull_rx,
+	TP_PROTO(const struct net_device *dev, u16 queue, unsigned int len),
+	TP_ARGS(dev, queue, len)
+);
+
+DECLARE_EVENT_CLASS(snull_queue,
+	TP_PROTO(const struct net_device *dev, u16 queue),
+	TP_ARGS(dev, queue),
+	TP_STRUCT__entry(
+		__string(	name,	dev->name	)
+		__field(	u16,	queue		)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->queue = queue;
+	),
+	TP_printk("dev=%s queue=%u", __get_str(name), __entry->queue)
+);
+
+/* TX queue stopped, as the pool can't hold the largest GSO skb */
+DEFINE_EVENT(snull_queue, snull_pool_empty,
+	TP_PROTO(const struct net_device *dev, u16 queue),
+	TP_ARGS(dev, queue)
+);
+
+/* stuck TX queue, kicked by the watchdog */
+DEFINE_EVENT(snull_queue, snull_tx_timeout,
+	TP_PROTO(const struct net_device *dev, u16 queue),
+	TP_ARGS(dev, queue)
+);
+
+#endif /* _KERNEL_IN_ACTION_SNULL_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>